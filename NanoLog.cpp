@@ -85,6 +85,20 @@ namespace nanolog
 {
 	typedef std::tuple<char, uint32_t, uint64_t, int32_t, int64_t, double, NanoLogLine::string_literal_t, char *> SupportedTypes;
 
+	std::atomic<void (*)(int64_t, int64_t)> write_hook = {nullptr};
+
+	void set_write_hook(void (*hook)(int64_t begin_ns, int64_t end_ns))
+	{
+		write_hook.store(hook, std::memory_order_release);
+	}
+
+	int64_t realtime_ns()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
 	char const *to_string(LogLevel loglevel)
 	{
 		switch (loglevel)
@@ -565,6 +579,8 @@ namespace nanolog
 
 		void write(NanoLogLine &logline)
 		{
+			void (*hook)(int64_t, int64_t) = write_hook.load(std::memory_order_acquire);
+			int64_t const begin_ns = hook ? realtime_ns() : 0;
 			auto pos = m_os->tellp();
 			logline.stringify(*m_os);
 			m_bytes_written += m_os->tellp() - pos;
@@ -572,6 +588,10 @@ namespace nanolog
 			{
 				roll_file();
 			}
+			if (hook)
+			{
+				hook(begin_ns, realtime_ns());
+			}
 		}
 
 	private:
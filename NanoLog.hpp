@@ -159,6 +159,12 @@ namespace nanolog
     void initialize(GuaranteedLogger gl, std::string const &log_directory, std::string const &log_file_name, uint32_t log_file_roll_size_mb);
     void initialize(NonGuaranteedLogger ngl, std::string const &log_directory, std::string const &log_file_name, uint32_t log_file_roll_size_mb);
 
+    /*
+     * Called on the writer thread around every log line it writes, e.g. to trace the writer.
+     * begin_ns / end_ns - CLOCK_REALTIME in ns. nullptr removes the hook.
+     */
+    void set_write_hook(void (*hook)(int64_t begin_ns, int64_t end_ns));
+
 } // namespace nanolog
 
 #define NANO_LOG(LEVEL) nanolog::NanoLog() == nanolog::NanoLogLine(LEVEL, __FILE__, __func__, __LINE__)
@@ -0,0 +1,207 @@
+// allocation hooks feeding threadAllocCounters, link this file into the program to count
+// heap allocations per thread (see PerfTool::enableAllocations())
+// with glibc, malloc / calloc / realloc / reallocarray / free, valloc / pvalloc and the aligned
+// variants are replaced and call the __libc_ implementations, operator new / delete go through
+// them; every block the replaced free() sees was counted by one of them; elsewhere only
+// operator new / delete are counted
+// cost: a malloc_usable_size() and two thread-local increments per allocation or free
+#include "allocHooks.hpp"
+#include <new>
+#include <cerrno>
+#include <cstdlib>
+#include <malloc.h>
+
+static const bool bAllocHooksLinked = (allocHooksLinked.store(true, std::memory_order_relaxed), true);
+
+static inline void *countAllocation(void *block)
+{
+    if (block != nullptr)
+    {
+        AllocCounters &counters = threadAllocCounters;
+        ++counters.allocations;
+        counters.allocatedBytes += malloc_usable_size(block);
+    }
+    return block;
+}
+
+static inline void countFree(void *block)
+{
+    if (block != nullptr)
+    {
+        AllocCounters &counters = threadAllocCounters;
+        ++counters.frees;
+        counters.freedBytes += malloc_usable_size(block);
+    }
+}
+
+#ifdef __GLIBC__
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *block, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void *__libc_valloc(size_t size);
+    void *__libc_pvalloc(size_t size);
+    void __libc_free(void *block);
+
+    void *malloc(size_t size)
+    {
+        return countAllocation(__libc_malloc(size));
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        return countAllocation(__libc_calloc(count, size));
+    }
+
+    // a move to a new block counts as a free and an allocation, a resize in place only as bytes
+    void *realloc(void *block, size_t size)
+    {
+        const size_t oldSize = block != nullptr ? malloc_usable_size(block) : 0;
+        void *result = __libc_realloc(block, size);
+        if (result == nullptr && size != 0)
+        {
+            // failed, block is left as it was
+            return nullptr;
+        }
+        AllocCounters &counters = threadAllocCounters;
+        if (result == block)
+        {
+            counters.allocatedBytes += malloc_usable_size(result);
+            counters.freedBytes += oldSize;
+            return result;
+        }
+        if (block != nullptr)
+        {
+            ++counters.frees;
+            counters.freedBytes += oldSize;
+        }
+        return countAllocation(result);
+    }
+
+    // realloc() of count * size, failing like glibc instead of wrapping around
+    void *reallocarray(void *block, size_t count, size_t size)
+    {
+        size_t bytes;
+        if (__builtin_mul_overflow(count, size, &bytes))
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        return realloc(block, bytes);
+    }
+
+    void free(void *block)
+    {
+        countFree(block);
+        __libc_free(block);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        return countAllocation(__libc_memalign(alignment, size));
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        return countAllocation(__libc_memalign(alignment, size));
+    }
+
+    void *valloc(size_t size)
+    {
+        return countAllocation(__libc_valloc(size));
+    }
+
+    void *pvalloc(size_t size)
+    {
+        return countAllocation(__libc_pvalloc(size));
+    }
+
+    int posix_memalign(void **result, size_t alignment, size_t size)
+    {
+        if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        {
+            return EINVAL;
+        }
+        void *block = countAllocation(__libc_memalign(alignment, size));
+        if (block == nullptr)
+        {
+            return ENOMEM;
+        }
+        *result = block;
+        return 0;
+    }
+}
+
+// counted by the replaced malloc / free
+static inline void *allocate(size_t size) { return malloc(size); }
+static inline void *allocateAligned(size_t alignment, size_t size) { return aligned_alloc(alignment, size); }
+static inline void release(void *block) { free(block); }
+
+#else
+
+static inline void *allocate(size_t size) { return countAllocation(malloc(size)); }
+static inline void *allocateAligned(size_t alignment, size_t size) { return countAllocation(aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)); }
+static inline void release(void *block)
+{
+    countFree(block);
+    free(block);
+}
+
+#endif
+
+// the loop of the standard operator new: call the new handler until it throws or there is memory
+static void *newBlock(size_t size, size_t alignment)
+{
+    size = size == 0 ? 1 : size;
+    for (;;)
+    {
+        void *block = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? allocateAligned(alignment, size) : allocate(size);
+        if (block != nullptr)
+        {
+            return block;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void *newBlock(size_t size, size_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return newBlock(size, alignment);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new(size_t size) { return newBlock(size, 0); }
+void *operator new[](size_t size) { return newBlock(size, 0); }
+void *operator new(size_t size, const std::nothrow_t &tag) noexcept { return newBlock(size, 0, tag); }
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return newBlock(size, 0, tag); }
+void *operator new(size_t size, std::align_val_t alignment) { return newBlock(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return newBlock(size, size_t(alignment)); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept { return newBlock(size, size_t(alignment), tag); }
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept { return newBlock(size, size_t(alignment), tag); }
+
+void operator delete(void *block) noexcept { release(block); }
+void operator delete[](void *block) noexcept { release(block); }
+void operator delete(void *block, size_t) noexcept { release(block); }
+void operator delete[](void *block, size_t) noexcept { release(block); }
+void operator delete(void *block, const std::nothrow_t &) noexcept { release(block); }
+void operator delete[](void *block, const std::nothrow_t &) noexcept { release(block); }
+void operator delete(void *block, std::align_val_t) noexcept { release(block); }
+void operator delete[](void *block, std::align_val_t) noexcept { release(block); }
+void operator delete(void *block, size_t, std::align_val_t) noexcept { release(block); }
+void operator delete[](void *block, size_t, std::align_val_t) noexcept { release(block); }
+void operator delete(void *block, std::align_val_t, const std::nothrow_t &) noexcept { release(block); }
+void operator delete[](void *block, std::align_val_t, const std::nothrow_t &) noexcept { release(block); }
@@ -0,0 +1,22 @@
+#ifndef ALLOC_HOOKS_HEADER_GUARD
+#define ALLOC_HOOKS_HEADER_GUARD
+
+#include <atomic>
+#include <cstdint>
+
+// heap allocations of one thread since it started, counted by the allocation hooks
+// (allocHooks.cpp, replacing operator new / delete and, with glibc, every malloc family entry
+// point and free); bytes are the usable sizes of the blocks, so freed bytes match allocated ones
+// without the hooks linked in, the counters stay 0
+struct AllocCounters
+{
+    uint64_t allocations, allocatedBytes, frees, freedBytes;
+};
+
+// the calling thread's counters: plain thread-local increments, no atomic and no sharing
+inline thread_local AllocCounters threadAllocCounters{0, 0, 0, 0};
+
+// set by allocHooks.cpp at static initialization
+inline std::atomic<bool> allocHooksLinked{false};
+
+#endif /* ALLOC_HOOKS_HEADER_GUARD */
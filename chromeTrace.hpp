@@ -0,0 +1,410 @@
+#ifndef CHROME_TRACE_HEADER_GUARD
+#define CHROME_TRACE_HEADER_GUARD
+
+#include "NanoLog.hpp"
+#include "spscQueue.hpp"
+#include "traceFile.hpp"
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <unistd.h>
+#include <condition_variable>
+
+// timeline of complete events (name, thread, begin, duration) in the Chrome trace event JSON
+// format, opens in ui.perfetto.dev or chrome://tracing without any server
+// every thread records into its own bounded SPSC buffer, a full buffer drops the event and
+// counts it, so a recording thread never blocks, allocates or takes a lock after its first
+// event; a background thread drains the buffers every flushInterval and appends to the file
+// the drop counts go to the file's otherData when the trace stops
+// the buffer of an exiting thread is drained by the background thread and then freed
+class ChromeTracer
+{
+public:
+    static ChromeTracer &instance(void)
+    {
+        static ChromeTracer tracer;
+        return tracer;
+    }
+
+    // id of the event name, registered on first use
+    // takes the lock, look it up once and keep the id
+    uint32_t name(const std::string &eventName)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (names[i] == eventName)
+            {
+                return uint32_t(i);
+            }
+        }
+        names.push_back(eventName);
+        return uint32_t(names.size() - 1);
+    }
+
+    // true between start() and stop() (or the end of its duration), check before record()
+    bool active(void) const { return bActive.load(std::memory_order_relaxed); }
+
+    // a complete event on the calling thread, times in CLOCK_REALTIME ns
+    void record(const uint32_t nameId, const int64_t beginNs, const int64_t durationNs)
+    {
+        ThreadBuffer &buffer = localBuffer();
+        if (!buffer.events.push({beginNs, durationNs, nameId}))
+        {
+            buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // trace to path (overwritten) until stop(), or for duration
+    // duration: 0 traces until stop(), else the file is complete once it has passed (call stop()
+    //           before the next start())
+    // eventsPerThread: buffer of every thread, a thread's buffer is sized at its first event
+    // bNanoLog: also trace every line the NanoLog writer thread writes
+    // return false if tracing already or the file can't be created
+    bool start(const std::string &path,
+               std::chrono::milliseconds duration = std::chrono::milliseconds(0),
+               size_t eventsPerThread = 1 << 16,
+               std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100),
+               bool bNanoLog = true)
+    {
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        if (file != nullptr)
+        {
+            return false;
+        }
+        file = fopen(path.c_str(), "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        nanologName = name("nanolog write");
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bufferEvents = eventsPerThread;
+            bFlushing = true;
+        }
+        startNs = realtimeNs();
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bFirstEvent = true;
+        bStop = false;
+        bActive.store(true, std::memory_order_relaxed);
+        if (bNanoLog)
+        {
+            nanolog::set_write_hook(&ChromeTracer::nanologHook);
+        }
+        flusher = std::thread([this, duration, flushInterval]()
+                              { flushLoop(duration, flushInterval); });
+        return true;
+    }
+
+    // stop tracing, write what is buffered and close the file
+    void stop(void)
+    {
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        if (file == nullptr)
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(flusherMutex);
+            bStop = true;
+        }
+        flusherCondition.notify_all();
+        flusher.join();
+        fclose(file);
+        file = nullptr;
+    }
+
+    // events dropped on full buffers in the current trace
+    uint64_t dropped(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t total = 0;
+        for (const RetiredThread &thread : retiredThreads)
+        {
+            total += thread.dropped;
+        }
+        for (const std::unique_ptr<ThreadBuffer> &buffer : buffers)
+        {
+            total += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // buffers held, of running threads and of exited ones the flusher has not drained yet
+    size_t threadBuffers(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return buffers.size();
+    }
+
+    ~ChromeTracer()
+    {
+        stop();
+        bDestroyed.store(true, std::memory_order_relaxed);
+    }
+
+private:
+    struct Event
+    {
+        int64_t beginNs, durationNs;
+        uint32_t nameId;
+    };
+
+    struct ThreadBuffer
+    {
+        explicit ThreadBuffer(size_t capacity) : events(capacity) {}
+
+        SpscQueue<Event> events;
+        std::atomic<uint64_t> dropped{0};
+        uint32_t threadId = 0;
+        // set when the thread exits, released so the flusher sees all of its events
+        std::atomic<bool> bRetired{false};
+    };
+
+    // hands the buffer of its thread back to the tracer when the thread exits
+    struct BufferOwner
+    {
+        ThreadBuffer *buffer = nullptr;
+
+        ~BufferOwner()
+        {
+            // threads started before the tracer, like the NanoLog writer, exit after it at process exit
+            if (buffer != nullptr && !bDestroyed.load(std::memory_order_relaxed))
+            {
+                instance().retire(buffer);
+            }
+        }
+    };
+
+    // an exited thread of the current trace, for the thread names and drop counts of finish()
+    struct RetiredThread
+    {
+        uint32_t threadId;
+        uint64_t dropped;
+    };
+
+    // guards names, buffers, retiredThreads and bFlushing
+    std::mutex mutex;
+    std::vector<std::string> names;
+    // buffers of the running threads, and of exited ones until the flusher drained them
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<RetiredThread> retiredThreads;
+    // a flusher thread runs and frees the retired buffers
+    bool bFlushing = false;
+    // trivially destructible, still readable by the thread exits after the tracer's destructor
+    static inline std::atomic<bool> bDestroyed{false};
+    size_t bufferEvents = 1 << 16;
+    uint32_t nanologName = 0;
+
+    // start() / stop()
+    std::mutex stateMutex;
+    std::atomic<bool> bActive{false};
+    FILE *file = nullptr;
+    int64_t startNs = 0;
+    bool bFirstEvent = true;
+
+    std::thread flusher;
+    std::mutex flusherMutex;
+    std::condition_variable flusherCondition;
+    bool bStop = false;
+    std::string pending;
+
+    ChromeTracer() = default;
+
+    static int64_t realtimeNs(void)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static void nanologHook(int64_t beginNs, int64_t endNs)
+    {
+        ChromeTracer &tracer = instance();
+        if (tracer.active())
+        {
+            tracer.record(tracer.nanologName, beginNs, endNs - beginNs);
+        }
+    }
+
+    ThreadBuffer &localBuffer(void)
+    {
+        // a plain pointer on the hot path, the owner with a destructor is only touched once
+        static thread_local ThreadBuffer *buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            static thread_local BufferOwner owner;
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ThreadBuffer(bufferEvents));
+            buffer = buffers.back().get();
+            buffer->threadId = TraceWriter::threadId();
+            owner.buffer = buffer;
+        }
+        return *buffer;
+    }
+
+    // the buffer's thread exits: the flusher drains and frees it, without one it goes at once
+    void retire(ThreadBuffer *buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bFlushing)
+        {
+            buffer->bRetired.store(true, std::memory_order_release);
+        }
+        else
+        {
+            eraseBuffer(buffer);
+        }
+    }
+
+    // called with mutex held
+    void eraseBuffer(ThreadBuffer *buffer)
+    {
+        buffers.erase(std::find_if(buffers.begin(), buffers.end(), [buffer](const std::unique_ptr<ThreadBuffer> &owned)
+                                   { return owned.get() == buffer; }));
+    }
+
+    void flushLoop(const std::chrono::milliseconds duration, const std::chrono::milliseconds flushInterval)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + duration;
+        std::unique_lock<std::mutex> lock(flusherMutex);
+        while (!flusherCondition.wait_for(lock, flushInterval, [this]()
+                                          { return bStop; }))
+        {
+            if (duration.count() != 0 && std::chrono::steady_clock::now() >= deadline)
+            {
+                break;
+            }
+            drain();
+        }
+        bActive.store(false, std::memory_order_relaxed);
+        nanolog::set_write_hook(nullptr);
+        drain();
+        finish();
+        // free the buffers of threads that exited after the last drain
+        std::lock_guard<std::mutex> bufferLock(mutex);
+        bFlushing = false;
+        for (size_t i = buffers.size(); i > 0; --i)
+        {
+            if (buffers[i - 1]->bRetired.load(std::memory_order_acquire))
+            {
+                buffers.erase(buffers.begin() + (i - 1));
+            }
+        }
+    }
+
+    // a ts / dur in us with ns decimals
+    void appendMicroseconds(const char *key, int64_t ns)
+    {
+        char text[48];
+        const int length = snprintf(text, sizeof(text), ",\"%s\":%lld.%03lld", key, (long long)(ns / 1000), (long long)(ns % 1000));
+        pending.append(text, length);
+    }
+
+    void appendEscaped(const std::string &text)
+    {
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                pending += '\\';
+            }
+            if ((unsigned char)c >= 0x20)
+            {
+                pending += c;
+            }
+        }
+    }
+
+    void beginEvent(void)
+    {
+        pending += bFirstEvent ? "{" : ",\n{";
+        bFirstEvent = false;
+    }
+
+    // move every buffered event to the file
+    void drain(void)
+    {
+        std::vector<std::string> eventNames;
+        std::vector<ThreadBuffer *> threadBuffers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            eventNames = names;
+            for (const std::unique_ptr<ThreadBuffer> &buffer : buffers)
+            {
+                threadBuffers.push_back(buffer.get());
+            }
+        }
+        const int pid = int(getpid());
+        Event event;
+        for (ThreadBuffer *buffer : threadBuffers)
+        {
+            // read before popping: once set, every event of the thread is in the buffer
+            const bool bRetired = buffer->bRetired.load(std::memory_order_acquire);
+            while (buffer->events.pop(event))
+            {
+                // events from before start() were recorded by a previous trace
+                if (event.beginNs < startNs)
+                {
+                    continue;
+                }
+                beginEvent();
+                pending += "\"name\":\"";
+                appendEscaped(eventNames[event.nameId]);
+                pending += "\",\"cat\":\"perftool\",\"ph\":\"X\"";
+                appendMicroseconds("ts", event.beginNs - startNs);
+                appendMicroseconds("dur", std::max<int64_t>(event.durationNs, 0));
+                pending += ",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(buffer->threadId) + "}";
+            }
+            if (bRetired)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                retiredThreads.push_back({buffer->threadId, buffer->dropped.load(std::memory_order_relaxed)});
+                eraseBuffer(buffer);
+            }
+        }
+        fwrite(pending.data(), 1, pending.size(), file);
+        fflush(file);
+        pending.clear();
+    }
+
+    // thread names, the drop counts and the end of the JSON object
+    void finish(void)
+    {
+        std::vector<RetiredThread> threads;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.swap(retiredThreads);
+            for (const std::unique_ptr<ThreadBuffer> &buffer : buffers)
+            {
+                threads.push_back({buffer->threadId, buffer->dropped.exchange(0, std::memory_order_relaxed)});
+            }
+        }
+        const int pid = int(getpid());
+        uint64_t total = 0;
+        for (const RetiredThread &thread : threads)
+        {
+            total += thread.dropped;
+            beginEvent();
+            pending += "\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) + ",\"tid\":" +
+                       std::to_string(thread.threadId) + ",\"args\":{\"name\":\"thread " + std::to_string(thread.threadId) +
+                       (thread.dropped != 0 ? ", dropped " + std::to_string(thread.dropped) : std::string()) + "\"}}";
+        }
+        pending += "\n],\"otherData\":{\"start_realtime_ns\":\"" + std::to_string(startNs) + "\",\"dropped_events\":\"" +
+                   std::to_string(total) + "\"}}\n";
+        fwrite(pending.data(), 1, pending.size(), file);
+        fflush(file);
+        pending.clear();
+    }
+};
+
+#endif /* CHROME_TRACE_HEADER_GUARD */
@@ -0,0 +1,348 @@
+#ifndef DD_SKETCH_HEADER_GUARD
+#define DD_SKETCH_HEADER_GUARD
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+
+// streaming quantile sketch (DDSketch, logarithmic mapping)
+// guarantee: for any quantile the returned value v' and the exact value v satisfy
+// |v' - v| <= relativeAccuracy * v, as long as v lies in [1, maxTrackableValue]
+// (0 is kept exactly, larger values are clamped)
+// memory: 8 bytes per bucket between the smallest and largest key seen (rounded out to
+// 64 keys), independent of the number of samples; latencies spanning 1us ~ 10ms take
+// about 4KB at a = 1%, the worst case is the whole [1, maxTrackableValue] range, for 1 hour
+// in ns: 1.2KB at a = 10%, 5.8KB at 2%, 12KB at 1%, 115KB at 0.1%; reset() keeps the range
+// the bucket layout only depends on the parameters, so two sketches built with the
+// same parameters merge without any loss, and so do serialized ones from other processes
+class DDSketch
+{
+public:
+    // relativeAccuracy: guaranteed relative error of every quantile, clamped to 10^-5 ~ 0.5
+    //                   (NaN falls back to the default)
+    // maxTrackableValue: larger values are clamped to this one
+    DDSketch(double relativeAccuracy = 0.02,
+             int64_t maxTrackableValue = 3600LL * 1000000000)
+        : relativeAccuracy(clampAccuracy(relativeAccuracy)),
+          maxTrackableValue(std::max<int64_t>(maxTrackableValue, 2)),
+          gamma((1 + this->relativeAccuracy) / (1 - this->relativeAccuracy)),
+          multiplier(1 / std::log(gamma)),
+          maxKey(key(this->maxTrackableValue))
+    {
+        reset();
+    }
+
+    void record(int64_t value, uint64_t count = 1)
+    {
+        value = std::min(std::max<int64_t>(value, 0), maxTrackableValue);
+        if (value == 0)
+        {
+            zeroCount += count;
+        }
+        else
+        {
+            const size_t k = key(value);
+            cover(k, k);
+            counts[k - offset] += count;
+        }
+        totalCount += count;
+        totalSum += (unsigned __int128)value * count;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+
+    // take back a value recorded before, used to expire samples from a window
+    void remove(int64_t value, uint64_t count = 1)
+    {
+        value = std::min(std::max<int64_t>(value, 0), maxTrackableValue);
+        if (value == 0)
+        {
+            zeroCount -= count;
+        }
+        else
+        {
+            const size_t k = key(value);
+            cover(k, k);
+            counts[k - offset] -= count;
+        }
+        totalCount -= count;
+        totalSum -= (unsigned __int128)value * count;
+        boundsValid = false;
+    }
+
+    // lossless merge, sketches must have been built with the same parameters
+    void add(const DDSketch &other)
+    {
+        if (!other.counts.empty())
+        {
+            cover(other.offset, other.offset + other.counts.size() - 1);
+            for (size_t i = 0; i < other.counts.size(); ++i)
+            {
+                counts[other.offset + i - offset] += other.counts[i];
+            }
+        }
+        zeroCount += other.zeroCount;
+        totalCount += other.totalCount;
+        totalSum += other.totalSum;
+        if (boundsValid && other.boundsValid)
+        {
+            minValue = std::min(minValue, other.minValue);
+            maxValue = std::max(maxValue, other.maxValue);
+        }
+        else
+        {
+            boundsValid = false;
+        }
+    }
+
+    // other must be a part of this sketch
+    void subtract(const DDSketch &other)
+    {
+        if (!other.counts.empty())
+        {
+            cover(other.offset, other.offset + other.counts.size() - 1);
+            for (size_t i = 0; i < other.counts.size(); ++i)
+            {
+                counts[other.offset + i - offset] -= other.counts[i];
+            }
+        }
+        zeroCount -= other.zeroCount;
+        totalCount -= other.totalCount;
+        totalSum -= other.totalSum;
+        boundsValid = false;
+    }
+
+    void reset(void)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        zeroCount = 0;
+        totalCount = 0;
+        totalSum = 0;
+        minValue = INT64_MAX;
+        maxValue = 0;
+        boundsValid = true;
+    }
+
+    uint64_t count(void) const { return totalCount; }
+
+    unsigned __int128 sum(void) const { return totalSum; }
+
+    int64_t min(void)
+    {
+        updateBounds();
+        return totalCount == 0 ? 0 : minValue;
+    }
+
+    int64_t max(void)
+    {
+        updateBounds();
+        return maxValue;
+    }
+
+    double mean(void) const
+    {
+        return totalCount == 0 ? 0 : (long double)totalSum / totalCount;
+    }
+
+    double stddev(void) const
+    {
+        if (totalCount == 0)
+        {
+            return 0;
+        }
+        double average = mean();
+        double deviationSum = zeroCount * average * average;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] != 0)
+            {
+                double deviation = value(offset + i) - average;
+                deviationSum += deviation * deviation * counts[i];
+            }
+        }
+        return std::sqrt(deviationSum / totalCount);
+    }
+
+    // quantile: 0 ~ 1, any quantile like 0.999 or 0.9999 can be asked for
+    int64_t valueAtQuantile(double quantile)
+    {
+        if (totalCount == 0)
+        {
+            return 0;
+        }
+        if (quantile <= 0)
+        {
+            return min();
+        }
+        if (quantile >= 1)
+        {
+            return max();
+        }
+        uint64_t rank = uint64_t(quantile * (totalCount - 1));
+        uint64_t countToIndex = zeroCount;
+        if (countToIndex > rank)
+        {
+            return 0;
+        }
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            countToIndex += counts[i];
+            if (countToIndex > rank)
+            {
+                return std::min(std::max(int64_t(std::llround(value(offset + i))), min()), max());
+            }
+        }
+        return max();
+    }
+
+    double accuracy(void) const { return relativeAccuracy; }
+
+    size_t memoryBytes(void) const { return sizeof(*this) + counts.size() * sizeof(uint64_t); }
+
+    // binary format: parameters followed by the non-empty buckets, so a sketch from
+    // another thread or process can be shipped around and merged with add()
+    void serialize(std::ostream &os) const
+    {
+        uint64_t nonEmpty = std::count_if(counts.begin(), counts.end(), [](uint64_t c)
+                                          { return c != 0; });
+        os.write((const char *)&relativeAccuracy, sizeof(relativeAccuracy));
+        os.write((const char *)&maxTrackableValue, sizeof(maxTrackableValue));
+        os.write((const char *)&zeroCount, sizeof(zeroCount));
+        os.write((const char *)&totalCount, sizeof(totalCount));
+        os.write((const char *)&totalSum, sizeof(totalSum));
+        os.write((const char *)&minValue, sizeof(minValue));
+        os.write((const char *)&maxValue, sizeof(maxValue));
+        os.write((const char *)&nonEmpty, sizeof(nonEmpty));
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] != 0)
+            {
+                const uint32_t k = uint32_t(offset + i);
+                os.write((const char *)&k, sizeof(k));
+                os.write((const char *)&counts[i], sizeof(counts[i]));
+            }
+        }
+    }
+
+    // return false if the stream is broken or was written with other parameters
+    bool deserialize(std::istream &is)
+    {
+        double accuracy;
+        int64_t trackable, minRead, maxRead;
+        uint64_t zeros, total, nonEmpty;
+        unsigned __int128 sumRead;
+        is.read((char *)&accuracy, sizeof(accuracy));
+        is.read((char *)&trackable, sizeof(trackable));
+        is.read((char *)&zeros, sizeof(zeros));
+        is.read((char *)&total, sizeof(total));
+        is.read((char *)&sumRead, sizeof(sumRead));
+        is.read((char *)&minRead, sizeof(minRead));
+        is.read((char *)&maxRead, sizeof(maxRead));
+        is.read((char *)&nonEmpty, sizeof(nonEmpty));
+        if (!is || accuracy != relativeAccuracy || trackable != maxTrackableValue)
+        {
+            return false;
+        }
+        reset();
+        for (uint64_t n = 0; n < nonEmpty; ++n)
+        {
+            uint32_t i;
+            uint64_t c;
+            is.read((char *)&i, sizeof(i));
+            is.read((char *)&c, sizeof(c));
+            if (!is || i > maxKey)
+            {
+                reset();
+                return false;
+            }
+            cover(i, i);
+            counts[i - offset] = c;
+        }
+        zeroCount = zeros, totalCount = total, totalSum = sumRead;
+        minValue = minRead, maxValue = maxRead;
+        return true;
+    }
+
+private:
+    const double relativeAccuracy;
+    const int64_t maxTrackableValue;
+    const double gamma, multiplier;
+    const size_t maxKey;
+
+    // dense buckets of the keys offset ~ offset + counts.size() - 1, empty until the first value
+    std::vector<uint64_t> counts;
+    size_t offset = 0;
+    uint64_t zeroCount, totalCount;
+    // 128-bit so the mean stays exact over any number of samples
+    unsigned __int128 totalSum;
+    int64_t minValue, maxValue;
+    // min and max are exact until values are removed, then they come from the buckets
+    bool boundsValid;
+
+    // below 10^-5 the counters take MBs, at 0 or less gamma is not a valid base
+    static double clampAccuracy(double accuracy)
+    {
+        return std::isnan(accuracy) ? 0.02 : std::min(std::max(accuracy, 1e-5), 0.5);
+    }
+
+    // bucket i holds (gamma^(i-1), gamma^i], values >= 1 so keys start at 0
+    size_t key(int64_t value) const
+    {
+        return size_t(std::ceil(std::log(double(value)) * multiplier));
+    }
+
+    // grow the buckets to take keys low ~ high, by 64 keys at least so a drifting
+    // range reallocates rarely; never past maxKey, which bounds the store
+    void cover(size_t low, size_t high)
+    {
+        const size_t end = offset + counts.size();
+        if (!counts.empty() && low >= offset && high < end)
+        {
+            return;
+        }
+        if (!counts.empty())
+        {
+            low = std::min(low, offset);
+            high = std::max(high, end - 1);
+        }
+        low -= low % 64;
+        high = std::min(high - high % 64 + 63, maxKey);
+        std::vector<uint64_t> grown(high - low + 1, 0);
+        if (!counts.empty())
+        {
+            std::copy(counts.begin(), counts.end(), grown.begin() + (offset - low));
+        }
+        counts.swap(grown);
+        offset = low;
+    }
+
+    // the value with the lowest relative error to everything in bucket i
+    double value(size_t i) const
+    {
+        return 2 * std::pow(gamma, double(i)) / (gamma + 1);
+    }
+
+    void updateBounds(void)
+    {
+        if (boundsValid)
+        {
+            return;
+        }
+        minValue = zeroCount != 0 ? 0 : INT64_MAX;
+        maxValue = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] != 0)
+            {
+                minValue = std::min(minValue, int64_t(std::llround(value(offset + i))));
+                maxValue = std::max(maxValue, int64_t(std::llround(value(offset + i))));
+            }
+        }
+        boundsValid = true;
+    }
+};
+
+#endif /* DD_SKETCH_HEADER_GUARD */
@@ -0,0 +1,190 @@
+#ifndef EPOCH_WINDOW_HEADER_GUARD
+#define EPOCH_WINDOW_HEADER_GUARD
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// sliding window built from a ring of per-epoch aggregates
+// samples are recorded into the open epoch, closing an epoch adds it to the window
+// aggregate and drops the oldest one with a bucket-wise subtract, so the cost of
+// moving the window is O(buckets) no matter how many samples it holds
+// queries cover the closed epochs and the open one, so a time based window answers before its
+// first epoch closes and never lags by an epoch: it spans epochs to epochs + 1 epochTime
+// Stats: HdrHistogram or DDSketch (record / add / subtract / reset / min / max / valueAtQuantile)
+template <class Stats>
+class EpochWindow
+{
+public:
+    // prototype: empty aggregate every epoch is copied from
+    // epochs: number of closed epochs kept in the window
+    // epochTime: 0 closes epochs by advance() (count based), else the length of an epoch in ns
+    EpochWindow(const Stats &prototype, int epochs, int64_t epochTime = 0)
+        : ring(std::max(epochs, 1) + 1, prototype),
+          window(prototype),
+          merged(prototype),
+          epochs(std::max(epochs, 1)),
+          epochTime(epochTime)
+    {
+        reset();
+    }
+
+    // record into the open epoch
+    void record(int64_t value)
+    {
+        ring[head].record(value);
+        bMergedStale = true;
+    }
+
+    // close the open epoch and move the window by one epoch
+    void advance(void)
+    {
+        window.add(ring[head]);
+        head = (head + 1) % ring.size();
+        if (closed == epochs)
+        {
+            // the slot being reused is the oldest closed epoch
+            window.subtract(ring[head]);
+        }
+        else
+        {
+            ++closed;
+        }
+        ring[head].reset();
+        epochStart += epochTime;
+        bMergedStale = true;
+    }
+
+    // time based window: close every epoch that ended before now (ns)
+    void advanceTo(int64_t now)
+    {
+        if (epochTime == 0)
+        {
+            return;
+        }
+        if (epochStart == INT64_MIN)
+        {
+            epochStart = now - now % epochTime;
+            return;
+        }
+        // after an idle gap longer than the window everything is expired anyway
+        for (int i = 0; now >= epochStart + epochTime && i <= epochs; ++i)
+        {
+            advance();
+        }
+        if (now >= epochStart + epochTime)
+        {
+            epochStart = now - now % epochTime;
+        }
+    }
+
+    void reset(void)
+    {
+        for (Stats &stats : ring)
+        {
+            stats.reset();
+        }
+        window.reset();
+        head = 0;
+        closed = 0;
+        epochStart = INT64_MIN;
+        bMergedStale = true;
+    }
+
+    // aggregate of the closed epochs
+    Stats &stats(void) { return window; }
+
+    // the open epoch
+    Stats &current(void) { return ring[head]; }
+
+    // time based window: start of its oldest epoch (on the time line of advanceTo()),
+    // INT64_MIN before the first sample or when count based
+    int64_t begin(void) const
+    {
+        return epochTime == 0 || epochStart == INT64_MIN ? INT64_MIN : epochStart - closed * epochTime;
+    }
+
+    uint64_t count(void) const { return window.count() + ring[head].count(); }
+
+    double mean(void) const { return view().mean(); }
+
+    double stddev(void) const { return view().stddev(); }
+
+    // exact, every epoch still knows its own min
+    int64_t min(void)
+    {
+        int64_t minValue = INT64_MAX;
+        forEachEpoch([&minValue](Stats &stats)
+                     { minValue = std::min(minValue, stats.min()); });
+        return count() == 0 ? 0 : minValue;
+    }
+
+    // exact, every epoch still knows its own max
+    int64_t max(void)
+    {
+        int64_t maxValue = 0;
+        forEachEpoch([&maxValue](Stats &stats)
+                     { maxValue = std::max(maxValue, stats.max()); });
+        return maxValue;
+    }
+
+    // quantile: 0 ~ 1, 0 gives min and 1 gives max
+    int64_t valueAtQuantile(double quantile)
+    {
+        if (quantile <= 0)
+        {
+            return min();
+        }
+        if (quantile >= 1)
+        {
+            return max();
+        }
+        return std::min(std::max(view().valueAtQuantile(quantile), min()), max());
+    }
+
+private:
+    std::vector<Stats> ring;
+    Stats window;
+    // window plus the open epoch, rebuilt by the first query after a change
+    mutable Stats merged;
+    mutable bool bMergedStale;
+    const int epochs;
+    const int64_t epochTime;
+    size_t head;
+    int closed;
+    int64_t epochStart;
+
+    // the closed epochs and the open one, no copy while the open epoch is empty (always the
+    // case when a count based window is queried right after advance())
+    Stats &view(void) const
+    {
+        if (ring[head].count() == 0)
+        {
+            return const_cast<Stats &>(window);
+        }
+        if (bMergedStale)
+        {
+            merged.reset();
+            merged.add(window);
+            merged.add(ring[head]);
+            bMergedStale = false;
+        }
+        return merged;
+    }
+
+    // the open epoch, then the closed ones from the newest
+    template <class Function>
+    void forEachEpoch(Function function)
+    {
+        for (int i = 0; i <= closed; ++i)
+        {
+            Stats &stats = ring[(head + ring.size() - i) % ring.size()];
+            if (stats.count() != 0)
+            {
+                function(stats);
+            }
+        }
+    }
+};
+
+#endif /* EPOCH_WINDOW_HEADER_GUARD */
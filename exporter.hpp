@@ -0,0 +1,380 @@
+#ifndef EXPORTER_HEADER_GUARD
+#define EXPORTER_HEADER_GUARD
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+
+// machine readable output of the reports, next to the NanoLog text
+// an exporter keeps its file open and buffers the formatted reports in memory, the file
+// is only written when bufferBytes are pending or flushInterval has passed, so thousands
+// of perf tools can share one exporter and report every second for a few syscalls
+// write() is thread safe, perf tools on any thread (or their reporter threads) can share one
+
+// one report of one perf tool, every duration in ns, every time point in CLOCK_REALTIME ns
+struct ExportRecord
+{
+    std::string_view name;
+    int64_t time, windowBegin, windowEnd;
+    uint64_t count;
+    double mean, stddev, min, max;
+    // measurement overhead already taken off every interval, 0 if none
+    double overhead;
+    // one value per Exporter::quantiles()
+    const double *quantileValues;
+};
+
+class Exporter
+{
+public:
+    // quantiles: 0 ~ 1, exported next to count / mean / std / min / max
+    // bufferBytes, flushInterval: write the file when this much is pending or this long has passed
+    Exporter(std::vector<double> quantiles, size_t bufferBytes, std::chrono::milliseconds flushInterval)
+        : quantileList(std::move(quantiles)), bufferBytes(bufferBytes), flushInterval(flushInterval),
+          lastFlush(std::chrono::steady_clock::now())
+    {
+        pending.reserve(std::min<size_t>(bufferBytes, 1 << 20));
+    }
+
+    virtual ~Exporter()
+    {
+        if (file != nullptr)
+        {
+            fclose(file);
+        }
+    }
+
+    Exporter(const Exporter &) = delete;
+    Exporter &operator=(const Exporter &) = delete;
+
+    const std::vector<double> &quantiles(void) const { return quantileList; }
+
+    void write(const ExportRecord &record)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        format(record);
+        if (pending.size() >= bufferBytes || std::chrono::steady_clock::now() - lastFlush >= flushInterval)
+        {
+            flushLocked();
+        }
+    }
+
+    // write everything pending now
+    void flush(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        flushLocked();
+    }
+
+protected:
+    const std::vector<double> quantileList;
+    // formatted output not written yet
+    std::string pending;
+    FILE *file = nullptr;
+
+    // append the record to pending, called with the lock held
+    virtual void format(const ExportRecord &record) = 0;
+
+    // write pending to the file, called with the lock held
+    virtual void flushLocked(void)
+    {
+        if (file != nullptr && !pending.empty())
+        {
+            fwrite(pending.data(), 1, pending.size(), file);
+            fflush(file);
+        }
+        pending.clear();
+        lastFlush = std::chrono::steady_clock::now();
+    }
+
+    // return true if the file was empty, so a header is due
+    bool openAppend(const std::string &path)
+    {
+        file = fopen(path.c_str(), "a");
+        return file != nullptr && ftell(file) == 0;
+    }
+
+    void append(const char *format, double value)
+    {
+        char text[64];
+        int length = snprintf(text, sizeof(text), format, value);
+        pending.append(text, std::min<size_t>(length, sizeof(text) - 1));
+    }
+
+    void appendInteger(int64_t value)
+    {
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+        pending.append(text, length);
+    }
+
+    // quantile as a key or a label value: 0.5, 0.99, 0.999
+    static std::string quantileName(double quantile)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%g", quantile);
+        return text;
+    }
+
+    // characters JSON and the Prometheus text format both have to escape
+    void appendEscaped(std::string_view text)
+    {
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                pending += '\\';
+                pending += c;
+            }
+            else if (c == '\n')
+            {
+                pending += "\\n";
+            }
+            else if ((unsigned char)c >= 0x20)
+            {
+                pending += c;
+            }
+        }
+    }
+
+private:
+    const size_t bufferBytes;
+    const std::chrono::milliseconds flushInterval;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point lastFlush;
+};
+
+// one JSON object per line:
+// {"name":"...","time":...,"window_begin":...,"window_end":...,"count":...,"mean":...,"std":...,
+//  "min":...,"max":...,"overhead":...,"quantiles":{"0.5":...,"0.99":...}}
+class JsonLinesExporter : public Exporter
+{
+public:
+    JsonLinesExporter(const std::string &path,
+                      std::vector<double> quantiles = {0.25, 0.5, 0.75, 0.95, 0.99, 0.999},
+                      size_t bufferBytes = 64 * 1024,
+                      std::chrono::milliseconds flushInterval = std::chrono::milliseconds(1000))
+        : Exporter(std::move(quantiles), bufferBytes, flushInterval)
+    {
+        openAppend(path);
+        for (double quantile : quantileList)
+        {
+            quantileKeys.push_back(",\"" + quantileName(quantile) + "\":");
+        }
+    }
+
+    ~JsonLinesExporter() override
+    {
+        flush();
+    }
+
+protected:
+    void format(const ExportRecord &record) override
+    {
+        pending += "{\"name\":\"";
+        appendEscaped(record.name);
+        pending += "\",\"time\":";
+        appendInteger(record.time);
+        pending += ",\"window_begin\":";
+        appendInteger(record.windowBegin);
+        pending += ",\"window_end\":";
+        appendInteger(record.windowEnd);
+        pending += ",\"count\":";
+        appendInteger(record.count);
+        append(",\"mean\":%.1f", record.mean);
+        append(",\"std\":%.1f", record.stddev);
+        append(",\"min\":%.0f", record.min);
+        append(",\"max\":%.0f", record.max);
+        append(",\"overhead\":%.0f", record.overhead);
+        pending += ",\"quantiles\":{";
+        for (size_t i = 0; i < quantileList.size(); ++i)
+        {
+            // the first key has no leading comma
+            pending.append(quantileKeys[i], i == 0 ? 1 : 0, std::string::npos);
+            append("%.0f", record.quantileValues[i]);
+        }
+        pending += "}}\n";
+    }
+
+private:
+    std::vector<std::string> quantileKeys;
+};
+
+// a header row when the file is new, then one row per report
+// name,time,window_begin,window_end,count,mean,std,min,max,overhead,p0.5,p0.99,...
+class CsvExporter : public Exporter
+{
+public:
+    CsvExporter(const std::string &path,
+                std::vector<double> quantiles = {0.25, 0.5, 0.75, 0.95, 0.99, 0.999},
+                size_t bufferBytes = 64 * 1024,
+                std::chrono::milliseconds flushInterval = std::chrono::milliseconds(1000))
+        : Exporter(std::move(quantiles), bufferBytes, flushInterval)
+    {
+        if (openAppend(path))
+        {
+            pending += "name,time,window_begin,window_end,count,mean,std,min,max,overhead";
+            for (double quantile : quantileList)
+            {
+                pending += ",p" + quantileName(quantile);
+            }
+            pending += '\n';
+        }
+    }
+
+    ~CsvExporter() override
+    {
+        flush();
+    }
+
+protected:
+    void format(const ExportRecord &record) override
+    {
+        // CSV quotes by doubling
+        pending += '"';
+        for (char c : record.name)
+        {
+            pending.append(c == '"' ? 2 : 1, c);
+        }
+        pending += "\",";
+        appendInteger(record.time);
+        pending += ',';
+        appendInteger(record.windowBegin);
+        pending += ',';
+        appendInteger(record.windowEnd);
+        pending += ',';
+        appendInteger(record.count);
+        append(",%.1f", record.mean);
+        append(",%.1f", record.stddev);
+        append(",%.0f", record.min);
+        append(",%.0f", record.max);
+        append(",%.0f", record.overhead);
+        for (size_t i = 0; i < quantileList.size(); ++i)
+        {
+            append(",%.0f", record.quantileValues[i]);
+        }
+        pending += '\n';
+    }
+};
+
+// Prometheus text exposition format, for the node exporter textfile collector
+// the file always holds the latest report of every perf tool, it is rewritten
+// (to path.tmp, then renamed) at most once per flushInterval
+// every series is a gauge of the last window: rolling windows overlap, so a report can't be
+// added to running _sum / _count totals, and a summary of window values would break rate()
+class PrometheusExporter : public Exporter
+{
+public:
+    PrometheusExporter(const std::string &path,
+                       std::vector<double> quantiles = {0.5, 0.9, 0.99, 0.999},
+                       std::chrono::milliseconds flushInterval = std::chrono::milliseconds(1000))
+        : Exporter(std::move(quantiles), SIZE_MAX, flushInterval), path(path)
+    {
+    }
+
+    ~PrometheusExporter() override
+    {
+        flush();
+    }
+
+protected:
+    void format(const ExportRecord &record) override
+    {
+        Snapshot &snapshot = snapshots[std::string(record.name)];
+        snapshot.count = record.count;
+        snapshot.mean = record.mean;
+        snapshot.stddev = record.stddev;
+        snapshot.min = record.min;
+        snapshot.max = record.max;
+        snapshot.overhead = record.overhead;
+        snapshot.quantileValues.assign(record.quantileValues, record.quantileValues + quantileList.size());
+        bDirty = true;
+    }
+
+    void flushLocked(void) override
+    {
+        if (bDirty)
+        {
+            pending.clear();
+            pending += "# HELP perftool_duration_ns interval duration quantiles in the window in ns\n"
+                       "# TYPE perftool_duration_ns gauge\n";
+            for (const auto &[name, snapshot] : snapshots)
+            {
+                for (size_t i = 0; i < quantileList.size(); ++i)
+                {
+                    appendSeries("perftool_duration_ns", name, quantileList[i]);
+                    append(" %.0f\n", snapshot.quantileValues[i]);
+                }
+            }
+            pending += "# HELP perftool_window_count intervals in the window\n"
+                       "# TYPE perftool_window_count gauge\n";
+            for (const auto &[name, snapshot] : snapshots)
+            {
+                appendSeries("perftool_window_count", name, -1);
+                pending += ' ';
+                appendInteger(snapshot.count);
+                pending += '\n';
+            }
+            appendGauge("perftool_duration_mean_ns", "mean interval in the window", &Snapshot::mean);
+            appendGauge("perftool_duration_stddev_ns", "standard deviation of the intervals in the window", &Snapshot::stddev);
+            appendGauge("perftool_duration_min_ns", "shortest interval in the window", &Snapshot::min);
+            appendGauge("perftool_duration_max_ns", "longest interval in the window", &Snapshot::max);
+            appendGauge("perftool_overhead_ns", "measurement overhead taken off every interval", &Snapshot::overhead);
+
+            // scrapers must never see a half written file
+            FILE *snapshotFile = fopen((path + ".tmp").c_str(), "w");
+            if (snapshotFile != nullptr)
+            {
+                fwrite(pending.data(), 1, pending.size(), snapshotFile);
+                fclose(snapshotFile);
+                rename((path + ".tmp").c_str(), path.c_str());
+            }
+            bDirty = false;
+        }
+        Exporter::flushLocked();
+    }
+
+private:
+    struct Snapshot
+    {
+        uint64_t count;
+        double mean, stddev, min, max, overhead;
+        std::vector<double> quantileValues;
+    };
+
+    const std::string path;
+    std::map<std::string, Snapshot> snapshots;
+    bool bDirty = false;
+
+    // quantile: < 0 for no quantile label
+    void appendSeries(const char *metric, const std::string &name, double quantile)
+    {
+        pending += metric;
+        pending += "{name=\"";
+        appendEscaped(name);
+        if (quantile >= 0)
+        {
+            pending += "\",quantile=\"" + quantileName(quantile);
+        }
+        pending += "\"}";
+    }
+
+    // one gauge family with a series per perf tool
+    void appendGauge(const char *metric, const char *help, double Snapshot::*field)
+    {
+        pending += std::string("# HELP ") + metric + ' ' + help + "\n# TYPE " + metric + " gauge\n";
+        for (const auto &[name, snapshot] : snapshots)
+        {
+            appendSeries(metric, name, -1);
+            append(" %.1f\n", snapshot.*field);
+        }
+    }
+};
+
+#endif /* EXPORTER_HEADER_GUARD */
@@ -0,0 +1,289 @@
+#ifndef HDR_HISTOGRAM_HEADER_GUARD
+#define HDR_HISTOGRAM_HEADER_GUARD
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// log-linear bucketed histogram in the style of HdrHistogram
+// values are split into power-of-two buckets, each bucket is split linearly into
+// sub buckets so every recorded value keeps significantDigits decimal digits of precision
+// memory is allocated once in the constructor, recording is O(1) and never allocates
+class HdrHistogram
+{
+public:
+    // lowestDiscernibleValue: smallest value that is distinguished from 0 (>= 1)
+    // highestTrackableValue: larger values are clamped to this one
+    // significantDigits: decimal digits of precision kept for every value (1 ~ 5)
+    HdrHistogram(int64_t lowestDiscernibleValue = 1,
+                 int64_t highestTrackableValue = 3600LL * 1000000000,
+                 int significantDigits = 2)
+        : lowestDiscernibleValue(std::max<int64_t>(lowestDiscernibleValue, 1)),
+          highestTrackableValue(std::max(highestTrackableValue, 2 * std::max<int64_t>(lowestDiscernibleValue, 1))),
+          significantDigits(std::min(std::max(significantDigits, 1), 5))
+    {
+        int64_t largestValueWithSingleUnitResolution = 2 * (int64_t)std::pow(10, this->significantDigits);
+        unitMagnitude = 63 - __builtin_clzll(this->lowestDiscernibleValue);
+        subBucketCountMagnitude = 64 - __builtin_clzll(largestValueWithSingleUnitResolution - 1);
+        subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+        subBucketCount = 1 << subBucketCountMagnitude;
+        subBucketHalfCount = subBucketCount / 2;
+        subBucketMask = int64_t(subBucketCount - 1) << unitMagnitude;
+
+        int64_t smallestUntrackableValue = int64_t(subBucketCount) << unitMagnitude;
+        bucketCount = 1;
+        while (smallestUntrackableValue <= this->highestTrackableValue)
+        {
+            if (smallestUntrackableValue > INT64_MAX / 2)
+            {
+                ++bucketCount;
+                break;
+            }
+            smallestUntrackableValue <<= 1;
+            ++bucketCount;
+        }
+        counts.assign((bucketCount + 1) * subBucketHalfCount, 0);
+        reset();
+    }
+
+    void record(int64_t value, uint64_t count = 1)
+    {
+        value = std::min(std::max<int64_t>(value, 0), highestTrackableValue);
+        counts[countsIndex(value)] += count;
+        totalCount += count;
+        totalSum += (unsigned __int128)value * count;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+
+    // take back a value recorded before, used to expire samples from a window
+    void remove(int64_t value, uint64_t count = 1)
+    {
+        value = std::min(std::max<int64_t>(value, 0), highestTrackableValue);
+        counts[countsIndex(value)] -= count;
+        totalCount -= count;
+        totalSum -= (unsigned __int128)value * count;
+        boundsValid = false;
+    }
+
+    // histograms must have been built with the same parameters
+    void add(const HdrHistogram &other)
+    {
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            counts[i] += other.counts[i];
+        }
+        totalCount += other.totalCount;
+        totalSum += other.totalSum;
+        if (boundsValid && other.boundsValid)
+        {
+            minValue = std::min(minValue, other.minValue);
+            maxValue = std::max(maxValue, other.maxValue);
+        }
+        else
+        {
+            boundsValid = false;
+        }
+    }
+
+    // other must be a part of this histogram
+    void subtract(const HdrHistogram &other)
+    {
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            counts[i] -= other.counts[i];
+        }
+        totalCount -= other.totalCount;
+        totalSum -= other.totalSum;
+        boundsValid = false;
+    }
+
+    void reset(void)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        totalCount = 0;
+        totalSum = 0;
+        minValue = INT64_MAX;
+        maxValue = 0;
+        boundsValid = true;
+    }
+
+    uint64_t count(void) const { return totalCount; }
+
+    unsigned __int128 sum(void) const { return totalSum; }
+
+    int64_t min(void)
+    {
+        updateBounds();
+        return totalCount == 0 ? 0 : minValue;
+    }
+
+    int64_t max(void)
+    {
+        updateBounds();
+        return maxValue;
+    }
+
+    double mean(void) const
+    {
+        return totalCount == 0 ? 0 : (long double)totalSum / totalCount;
+    }
+
+    double stddev(void) const
+    {
+        if (totalCount == 0)
+        {
+            return 0;
+        }
+        double average = mean(), deviationSum = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] != 0)
+            {
+                double deviation = medianEquivalentValue(valueFromIndex(i)) - average;
+                deviationSum += deviation * deviation * counts[i];
+            }
+        }
+        return std::sqrt(deviationSum / totalCount);
+    }
+
+    // quantile: 0 ~ 1, 0 gives min and 1 gives max
+    int64_t valueAtQuantile(double quantile)
+    {
+        if (totalCount == 0)
+        {
+            return 0;
+        }
+        if (quantile <= 0)
+        {
+            return min();
+        }
+        if (quantile >= 1)
+        {
+            return max();
+        }
+        uint64_t countAtQuantile = std::max<uint64_t>(1, uint64_t(quantile * totalCount + 0.5));
+        uint64_t countToIndex = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            countToIndex += counts[i];
+            if (countToIndex >= countAtQuantile)
+            {
+                return std::min(highestEquivalentValue(valueFromIndex(i)), max());
+            }
+        }
+        return max();
+    }
+
+    // bucket layout, lets callers keep their own counters and fold them in with addAtIndex()
+    size_t countsLength(void) const { return counts.size(); }
+
+    uint64_t countAtIndex(size_t index) const { return counts[index]; }
+
+    void addAtIndex(size_t index, uint64_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        int64_t value = valueFromIndex(index);
+        counts[index] += count;
+        totalCount += count;
+        totalSum += (unsigned __int128)medianEquivalentValue(value) * count;
+        if (boundsValid)
+        {
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, highestEquivalentValue(value));
+        }
+    }
+
+    size_t countsIndex(int64_t value) const
+    {
+        int bucketIndex = getBucketIndex(value);
+        int subBucketIndex = int(value >> (bucketIndex + unitMagnitude));
+        return (size_t(bucketIndex + 1) << subBucketHalfCountMagnitude) + (subBucketIndex - subBucketHalfCount);
+    }
+
+    int64_t valueFromIndex(size_t index) const
+    {
+        int bucketIndex = int(index >> subBucketHalfCountMagnitude) - 1;
+        int subBucketIndex = int(index & (subBucketHalfCount - 1)) + subBucketHalfCount;
+        if (bucketIndex < 0)
+        {
+            subBucketIndex -= subBucketHalfCount;
+            bucketIndex = 0;
+        }
+        return int64_t(subBucketIndex) << (bucketIndex + unitMagnitude);
+    }
+
+    int64_t sizeOfEquivalentValueRange(int64_t value) const
+    {
+        int bucketIndex = getBucketIndex(value);
+        int subBucketIndex = int(value >> (bucketIndex + unitMagnitude));
+        int adjustedBucket = subBucketIndex >= subBucketCount ? bucketIndex + 1 : bucketIndex;
+        return int64_t(1) << (unitMagnitude + adjustedBucket);
+    }
+
+    int64_t lowestEquivalentValue(int64_t value) const
+    {
+        int bucketIndex = getBucketIndex(value);
+        int subBucketIndex = int(value >> (bucketIndex + unitMagnitude));
+        return int64_t(subBucketIndex) << (bucketIndex + unitMagnitude);
+    }
+
+    int64_t highestEquivalentValue(int64_t value) const
+    {
+        return lowestEquivalentValue(value) + sizeOfEquivalentValueRange(value) - 1;
+    }
+
+    int64_t medianEquivalentValue(int64_t value) const
+    {
+        return lowestEquivalentValue(value) + (sizeOfEquivalentValueRange(value) >> 1);
+    }
+
+    int64_t highestTrackable(void) const { return highestTrackableValue; }
+
+private:
+    const int64_t lowestDiscernibleValue, highestTrackableValue;
+    const int significantDigits;
+    int unitMagnitude, subBucketCountMagnitude, subBucketHalfCountMagnitude;
+    int subBucketCount, subBucketHalfCount, bucketCount;
+    int64_t subBucketMask;
+
+    std::vector<uint64_t> counts;
+    uint64_t totalCount;
+    // 128-bit so the mean stays exact over any number of samples
+    unsigned __int128 totalSum;
+    int64_t minValue, maxValue;
+    // min and max are exact until values are removed, then they come from the buckets
+    bool boundsValid;
+
+    int getBucketIndex(int64_t value) const
+    {
+        int pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask);
+        return pow2Ceiling - unitMagnitude - (subBucketHalfCountMagnitude + 1);
+    }
+
+    void updateBounds(void)
+    {
+        if (boundsValid)
+        {
+            return;
+        }
+        minValue = INT64_MAX;
+        maxValue = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] != 0)
+            {
+                int64_t value = valueFromIndex(i);
+                minValue = std::min(minValue, value);
+                maxValue = std::max(maxValue, highestEquivalentValue(value));
+            }
+        }
+        boundsValid = true;
+    }
+};
+
+#endif /* HDR_HISTOGRAM_HEADER_GUARD */
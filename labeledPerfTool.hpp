@@ -0,0 +1,350 @@
+#ifndef LABELED_PERF_TOOL_HEADER_GUARD
+#define LABELED_PERF_TOOL_HEADER_GUARD
+
+#include "tscClock.hpp"
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+#include <string_view>
+
+// process-wide table of label strings (endpoints, shards, message types), each one is
+// interned once into a compact id; open addressing with linear probing on an FNV-1a hash
+class LabelInterner
+{
+public:
+    static LabelInterner &instance(void)
+    {
+        static LabelInterner interner;
+        return interner;
+    }
+
+    // id of label, added on first use
+    // takes the lock, intern once (e.g. into a static) and keep the id
+    uint32_t intern(std::string_view label)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((labels.size() + 1) * 10 > slots.size() * 7)
+        {
+            grow();
+        }
+        const size_t mask = slots.size() - 1;
+        for (size_t i = hash(label) & mask;; i = (i + 1) & mask)
+        {
+            if (slots[i] == 0)
+            {
+                labels.emplace_back(label);
+                slots[i] = uint32_t(labels.size());
+                return uint32_t(labels.size() - 1);
+            }
+            if (labels[slots[i] - 1] == label)
+            {
+                return slots[i] - 1;
+            }
+        }
+    }
+
+    // a copy of every label by id, the lock is not held while it is used
+    std::vector<std::string> names(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return labels;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::string> labels;
+    // id + 1 of the label hashed there, 0 if empty
+    std::vector<uint32_t> slots;
+
+    LabelInterner() = default;
+
+    static uint64_t hash(std::string_view label)
+    {
+        uint64_t value = 14695981039346656037ULL;
+        for (char c : label)
+        {
+            value = (value ^ (unsigned char)c) * 1099511628211ULL;
+        }
+        return value;
+    }
+
+    void grow(void)
+    {
+        slots.assign(std::max<size_t>(64, slots.size() * 2), 0);
+        const size_t mask = slots.size() - 1;
+        for (size_t id = 0; id < labels.size(); ++id)
+        {
+            size_t i = hash(labels[id]) & mask;
+            while (slots[i] != 0)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = uint32_t(id + 1);
+        }
+    }
+};
+
+// latency statistics per label, for thousands of labels in one object
+// a key is one interned label, or a pair of them (key(endpoint, shard)); keys find their
+// statistics through an open-addressing table (linear probing, Fibonacci hashing), the
+// statistics are fixed size entries and their histogram pages come from a pool: a page of
+// 64 buckets is only taken when a sample falls in its range, so a label with latencies
+// within a factor of 16 costs about 400 bytes and 10k labels fit in a few MB
+// histogram: 16 linear sub buckets per power of two, quantiles within 3.2% (bucket midpoints)
+// hot path: a hash lookup and a record, no lock; allocates only for a new key or a new page
+// not thread safe, one per thread like PerfTool, the interner is shared
+class LabeledPerfTool
+{
+public:
+    // id of label, see LabelInterner
+    static uint32_t label(std::string_view name) { return LabelInterner::instance().intern(name); }
+
+    static uint64_t key(uint32_t label) { return uint64_t(label) + 1; }
+
+    // combined key of two dimensions, reported as "first,second"
+    static uint64_t key(uint32_t first, uint32_t second) { return (uint64_t(first) + 1) << 32 | (uint64_t(second) + 1); }
+
+    // expectedKeys: table and statistics reserved for this many keys, more keys grow them
+    explicit LabeledPerfTool(size_t expectedKeys = 1024)
+    {
+        stats.reserve(expectedKeys);
+        size_t capacity = 64;
+        while (capacity * 7 < expectedKeys * 10)
+        {
+            capacity *= 2;
+        }
+        resize(capacity);
+    }
+
+    LabeledPerfTool(const LabeledPerfTool &) = delete;
+    LabeledPerfTool &operator=(const LabeledPerfTool &) = delete;
+
+    uint64_t begin(void) { return TscClock::beginTicks(); }
+
+    // record the interval since beginTime (from begin()) for key
+    void end(uint64_t key, uint64_t beginTime) { record(key, TscClock::endTicks() - beginTime); }
+
+    // record an interval of ticks for key
+    void record(uint64_t key, uint64_t ticks)
+    {
+        Stats &entry = lookup(key);
+        ++entry.count;
+        entry.sum += ticks;
+        entry.min = std::min(entry.min, ticks);
+        entry.max = std::max(entry.max, ticks);
+        const uint32_t bucket = bucketOf(ticks);
+        uint32_t &page = entry.pages[bucket / pageSize];
+        if (page == 0)
+        {
+            page = allocatePage();
+        }
+        ++pageAt(page)[bucket % pageSize];
+    }
+
+    // statistics of one key in ns
+    struct Summary
+    {
+        std::string label;
+        uint64_t count;
+        double mean, min, p50, p99, p999, max;
+    };
+
+    // every key recorded since the last reset(), in no particular order
+    std::vector<Summary> summaries(void)
+    {
+        const std::vector<std::string> names = LabelInterner::instance().names();
+        std::vector<Summary> result;
+        result.reserve(stats.size());
+        for (const Stats &entry : stats)
+        {
+            result.push_back({labelOf(entry.key, names), entry.count, TscClock::ticksToNs(entry.sum) / entry.count,
+                              TscClock::ticksToNs(entry.min), TscClock::ticksToNs(valueAtQuantile(entry, 0.5)),
+                              TscClock::ticksToNs(valueAtQuantile(entry, 0.99)),
+                              TscClock::ticksToNs(valueAtQuantile(entry, 0.999)), TscClock::ticksToNs(entry.max)});
+        }
+        return result;
+    }
+
+    // one line per key: label count mean p50 p99 p99.9 max (ns)
+    // topN: 0 lists every key by label, else the topN keys with the highest p99, highest first
+    void report(std::ostream &os, size_t topN = 0)
+    {
+        std::vector<Summary> result = summaries();
+        if (topN == 0)
+        {
+            std::sort(result.begin(), result.end(), [](const Summary &a, const Summary &b)
+                      { return a.label < b.label; });
+        }
+        else
+        {
+            topN = std::min(topN, result.size());
+            std::partial_sort(result.begin(), result.begin() + topN, result.end(), [](const Summary &a, const Summary &b)
+                              { return a.p99 > b.p99; });
+            result.resize(topN);
+        }
+        os << "label count mean(ns) p50(ns) p99(ns) p99.9(ns) max(ns)\n";
+        for (const Summary &summary : result)
+        {
+            os << summary.label << ' ' << summary.count << ' ' << uint64_t(summary.mean) << ' ' << uint64_t(summary.p50)
+               << ' ' << uint64_t(summary.p99) << ' ' << uint64_t(summary.p999) << ' ' << uint64_t(summary.max) << '\n';
+        }
+    }
+
+    // forget every key, the memory is kept for the next window
+    void reset(void)
+    {
+        stats.clear();
+        std::fill(slots.begin(), slots.end(), Slot{0, 0});
+        usedPages = 0;
+    }
+
+    size_t size(void) const { return stats.size(); }
+
+    // bytes held by the table, the statistics and the page pool
+    size_t memoryBytes(void) const
+    {
+        return slots.capacity() * sizeof(Slot) + stats.capacity() * sizeof(Stats) + chunks.size() * pagesPerChunk * sizeof(Page);
+    }
+
+private:
+    // buckets 0 ~ 15 hold the values 0 ~ 15, then 16 per power of two up to 2^63
+    static constexpr uint32_t subBuckets = 16, pageSize = 64, pageCount = 1024 / pageSize, pagesPerChunk = 256;
+
+    using Page = uint32_t[pageSize];
+
+    struct Stats
+    {
+        uint64_t key, count, sum, min, max;
+        // index + 1 of the page in the pool, 0 if no sample fell in its range yet
+        uint32_t pages[pageCount];
+    };
+
+    struct Slot
+    {
+        // 0 if empty
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<Slot> slots;
+    int shift = 0;
+    std::vector<Stats> stats;
+    // chunks never move, so a page index stays valid while the pool grows
+    std::vector<std::unique_ptr<Page[]>> chunks;
+    uint32_t usedPages = 0;
+
+    static uint32_t bucketOf(uint64_t value)
+    {
+        if (value < subBuckets)
+        {
+            return uint32_t(value);
+        }
+        const int exponent = 63 - __builtin_clzll(value);
+        return uint32_t((exponent - 3) * subBuckets + ((value >> (exponent - 4)) & (subBuckets - 1)));
+    }
+
+    // midpoint of the bucket
+    static uint64_t valueOf(uint32_t bucket)
+    {
+        if (bucket < subBuckets)
+        {
+            return bucket;
+        }
+        const int exponent = int(bucket / subBuckets) + 3;
+        const uint64_t width = uint64_t(1) << (exponent - 4);
+        return (subBuckets + bucket % subBuckets) * width + width / 2;
+    }
+
+    Stats &lookup(uint64_t key)
+    {
+        const size_t mask = slots.size() - 1;
+        for (size_t i = (key * 0x9E3779B97F4A7C15ULL) >> shift;; i = (i + 1) & mask)
+        {
+            if (slots[i].key == key)
+            {
+                return stats[slots[i].index];
+            }
+            if (slots[i].key == 0)
+            {
+                return insert(i, key);
+            }
+        }
+    }
+
+    Stats &insert(size_t slot, uint64_t key)
+    {
+        if ((stats.size() + 1) * 10 > slots.size() * 7)
+        {
+            resize(slots.size() * 2);
+            return lookup(key);
+        }
+        slots[slot] = {key, uint32_t(stats.size())};
+        stats.push_back({key, 0, 0, UINT64_MAX, 0, {}});
+        return stats.back();
+    }
+
+    // capacity: a power of two
+    void resize(size_t capacity)
+    {
+        slots.assign(capacity, Slot{0, 0});
+        shift = 64 - __builtin_ctzll(capacity);
+        for (uint32_t index = 0; index < stats.size(); ++index)
+        {
+            size_t i = (stats[index].key * 0x9E3779B97F4A7C15ULL) >> shift;
+            while (slots[i].key != 0)
+            {
+                i = (i + 1) & (capacity - 1);
+            }
+            slots[i] = {stats[index].key, index};
+        }
+    }
+
+    // index + 1 of a zeroed page
+    uint32_t allocatePage(void)
+    {
+        if (usedPages == chunks.size() * pagesPerChunk)
+        {
+            chunks.emplace_back(new Page[pagesPerChunk]);
+        }
+        Page &page = pageAt(++usedPages);
+        std::fill(page, page + pageSize, 0);
+        return usedPages;
+    }
+
+    Page &pageAt(uint32_t page) { return chunks[(page - 1) / pagesPerChunk][(page - 1) % pagesPerChunk]; }
+
+    uint64_t valueAtQuantile(const Stats &entry, double quantile)
+    {
+        const uint64_t target = std::max<uint64_t>(1, uint64_t(quantile * entry.count + 0.5));
+        uint64_t seen = 0;
+        for (uint32_t p = 0; p < pageCount; ++p)
+        {
+            if (entry.pages[p] == 0)
+            {
+                continue;
+            }
+            const Page &page = pageAt(entry.pages[p]);
+            for (uint32_t i = 0; i < pageSize; ++i)
+            {
+                seen += page[i];
+                if (seen >= target)
+                {
+                    return std::min(std::max(valueOf(p * pageSize + i), entry.min), entry.max);
+                }
+            }
+        }
+        return entry.max;
+    }
+
+    static std::string labelOf(uint64_t key, const std::vector<std::string> &names)
+    {
+        const uint32_t first = uint32_t(key >> 32), second = uint32_t(key);
+        return first == 0 ? names[second - 1] : names[first - 1] + ',' + names[second - 1];
+    }
+};
+
+#endif /* LABELED_PERF_TOOL_HEADER_GUARD */
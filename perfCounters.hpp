@@ -0,0 +1,200 @@
+#ifndef PERF_COUNTERS_HEADER_GUARD
+#define PERF_COUNTERS_HEADER_GUARD
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// one perf_event_open counter
+struct PerfEvent
+{
+    uint32_t type;
+    uint64_t config;
+    std::string name;
+};
+
+// a perf_event group counting the calling thread (user space only), read at both ends of an interval
+// reads go through rdpmc when the kernel allows it (cap_user_rdpmc, a few ns per counter),
+// else through one read() of the whole group (a syscall, around 1us)
+// a group only counts the thread that created it
+class PerfCounters
+{
+public:
+    static std::vector<PerfEvent> hardwareEvents(void)
+    {
+        return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"}};
+    }
+
+    // what is left when the PMU isn't exposed, e.g. in most VMs
+    static std::vector<PerfEvent> softwareEvents(void)
+    {
+        return {{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"}};
+    }
+
+    // events: empty opens hardwareEvents(), or softwareEvents() if the hardware ones can't be opened
+    explicit PerfCounters(const std::vector<PerfEvent> &events = {})
+    {
+        if (!events.empty())
+        {
+            open(events);
+        }
+        else if (!open(hardwareEvents()))
+        {
+            open(softwareEvents());
+        }
+    }
+
+    ~PerfCounters()
+    {
+        close();
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // false if no event could be opened (no permission, seccomp, perf_event_paranoid)
+    bool isOpen(void) const { return !fds.empty(); }
+
+    // true if read() avoids the syscall
+    bool usesRdpmc(void) const { return bRdpmc; }
+
+    size_t size(void) const { return eventList.size(); }
+
+    const PerfEvent &event(size_t i) const { return eventList[i]; }
+
+    // values: size() counters
+    void read(uint64_t *values)
+    {
+        if (bRdpmc && readRdpmc(values))
+        {
+            return;
+        }
+        readGroup(values);
+    }
+
+private:
+    std::vector<PerfEvent> eventList;
+    std::vector<int> fds;
+    std::vector<perf_event_mmap_page *> pages;
+    std::vector<uint64_t> groupBuffer;
+    bool bRdpmc = false;
+
+    bool open(const std::vector<PerfEvent> &events)
+    {
+        for (const PerfEvent &event : events)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = event.type;
+            attr.config = event.config;
+            attr.disabled = fds.empty() ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, fds.empty() ? -1 : fds[0], 0));
+            if (fd < 0)
+            {
+                close();
+                return false;
+            }
+            fds.push_back(fd);
+        }
+        eventList = events;
+        groupBuffer.assign(1 + events.size(), 0);
+
+        // the mapped page tells whether rdpmc may be used and which counter to read
+        bRdpmc = true;
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        for (int fd : fds)
+        {
+            void *page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, fd, 0);
+            pages.push_back(page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page *>(page));
+            bRdpmc = bRdpmc && pages.back() != nullptr && pages.back()->cap_user_rdpmc;
+        }
+
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    void close(void)
+    {
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        for (perf_event_mmap_page *page : pages)
+        {
+            if (page != nullptr)
+            {
+                munmap(page, pageSize);
+            }
+        }
+        for (int fd : fds)
+        {
+            ::close(fd);
+        }
+        pages.clear();
+        fds.clear();
+        eventList.clear();
+        bRdpmc = false;
+    }
+
+    static uint64_t rdpmc(uint32_t counter)
+    {
+        uint32_t low, high;
+        __asm__ volatile("rdpmc"
+                         : "=a"(low), "=d"(high)
+                         : "c"(counter));
+        return (uint64_t(high) << 32) | low;
+    }
+
+    // the seqlock protocol of perf_event_mmap_page
+    // return false if a counter isn't on a PMU right now (index 0), read() then falls back
+    bool readRdpmc(uint64_t *values)
+    {
+        for (size_t i = 0; i < pages.size(); ++i)
+        {
+            const volatile perf_event_mmap_page *page = pages[i];
+            uint32_t sequence;
+            int64_t count;
+            do
+            {
+                sequence = page->lock;
+                __asm__ volatile("" ::: "memory");
+                const uint32_t index = page->index;
+                if (!page->cap_user_rdpmc || index == 0)
+                {
+                    return false;
+                }
+                const int shift = 64 - page->pmc_width;
+                count = int64_t(rdpmc(index - 1) << shift) >> shift;
+                count += page->offset;
+                __asm__ volatile("" ::: "memory");
+            } while (page->lock != sequence);
+            values[i] = uint64_t(count);
+        }
+        return true;
+    }
+
+    // PERF_FORMAT_GROUP: the number of events, then one value per event
+    void readGroup(uint64_t *values)
+    {
+        const ssize_t bytes = ::read(fds[0], groupBuffer.data(), groupBuffer.size() * sizeof(uint64_t));
+        for (size_t i = 0; i < eventList.size(); ++i)
+        {
+            values[i] = bytes > 0 ? groupBuffer[i + 1] : 0;
+        }
+    }
+};
+
+#endif /* PERF_COUNTERS_HEADER_GUARD */
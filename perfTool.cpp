@@ -1,73 +1,345 @@
 // TL = TimeList
 #include "NanoLog.hpp"
+#include "tscClock.hpp"
+#include "hdrHistogram.hpp"
+#include "perfToolPolicy.hpp"
+#include "spscQueue.hpp"
+#include "traceFile.hpp"
+#include "exporter.hpp"
+#include "timerRegistry.hpp"
+#include "labeledPerfTool.hpp"
+#include "chromeTrace.hpp"
+#include "perfCounters.hpp"
+#include "allocHooks.hpp"
+#include "threadShards.hpp"
 #include <bits/stdc++.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <linux/types.h>
 
-#include <cereal/archives/json.hpp>
-#include <cereal/types/string.hpp>
-#include <iostream>
-#include <fstream>
-
-const int RDTSC_PARAMETER = 2 * 1e9;
 const char TIME_MESSAGE_LIST[4][3] = {"ns", "us", "ms", "s"};
 
-static __u64 rdtsc()
+// NanoLog is process wide and initialize() replaces the logger under anything still logging
+// (reporter threads, other perf tools), so it is set up once: the first perf tool picks the
+// log file in the working directory, the later ones log into it
+static void initializeLog(const std::string &describe)
 {
-    __u32 lo, hi;
-    __asm__ __volatile__("rdtsc"
-                         : "=a"(lo), "=d"(hi));
-    return (__u64)hi << 32 | lo;
+    static std::once_flag once;
+    std::call_once(once, [&describe]()
+                   {
+                       char *directory = get_current_dir_name();
+                       nanolog::initialize(nanolog::GuaranteedLogger(), std::string(directory) + '/', describe, 1);
+                       free(directory); });
 }
 
-static bool operator<(const timespec &lhs, const timespec &rhs)
+// log description information
+// describe: which perf tool is reporting
+// subReport: report online metrics information
+static void logDescribeLine(const std::string &describe, const bool subReport)
 {
-    if (lhs.tv_sec == rhs.tv_sec)
-        return lhs.tv_nsec < rhs.tv_nsec;
-    else
-        return lhs.tv_sec < rhs.tv_sec;
+    const time_t now = time(nullptr);
+    // reporter threads log next to NanoLog's writer thread, localtime() would share its buffer
+    tm local;
+    localtime_r(&now, &local);
+    char tmp[64];
+    strftime(tmp, sizeof(tmp), "%Y-%m-%d %H:%M:%S", &local);
+    // pass a std::string, a char array would only be kept by pointer until the log thread formats it
+    LOG_INFO << '<' << std::string(tmp) << "> " << describe << (subReport ? " sub report " : " ") << "statistics";
 }
 
-static timespec operator+(const timespec &lhs, const timespec &rhs)
+// value with a fixed number of decimals, a double streamed into NanoLog turns scientific from 10^6 on
+static std::string fixedText(const double value, const int decimals)
 {
-    timespec sum = {lhs.tv_sec + rhs.tv_sec, lhs.tv_nsec + rhs.tv_nsec};
-    if (sum.tv_nsec > 1e9)
-    {
-        sum.tv_nsec -= 1e9;
-        sum.tv_sec += 1;
-    }
-    return sum;
+    char text[512];
+    snprintf(text, sizeof(text), "%.*f", decimals, value);
+    return text;
 }
 
-static timespec operator-(const timespec &lhs, const timespec &rhs)
+// log metrics information
+// metricName: the name of the metric
+// metricData: the data of the metric in ns
+// timeScale, timeMessage: unit of the output, whole seconds are written apart unless the unit is second
+// ns are written as an integer, us / ms / s keep ns resolution with fixed decimals
+static void logMetricLine(const std::string &metricName, const double metricData, const long timeScale, const std::string &timeMessage)
 {
-    timespec delta = {lhs.tv_sec - rhs.tv_sec, lhs.tv_nsec - rhs.tv_nsec};
-    if (delta.tv_nsec < 0)
+    if (timeScale == 1000000000)
     {
-        delta.tv_sec -= 1;
-        delta.tv_nsec += 1e9;
+        LOG_INFO << metricName << ":" << fixedText(metricData / 1e9, 9) << timeMessage;
+        return;
     }
-    return delta;
+    const int64_t seconds = int64_t(metricData / 1e9);
+    const int decimals = timeScale == 1 ? 0 : timeScale == 1000 ? 3 : 6;
+    LOG_INFO << metricName << ":" << seconds << "s" << fixedText((metricData - seconds * 1e9) / timeScale, decimals) << timeMessage;
 }
 
-static timespec operator/(const timespec &lhs, const int &rhs)
+// the optional per interval probes of a BasicPerfTool: perf_event counters, the on-CPU / off-CPU
+// split and heap allocations, read around the clock at begin() / end()
+// kept out of line and created by the first enable call, so a perf tool without probes carries
+// one pointer for them and tests it once in begin() / end() / report()
+class IntervalProbes
 {
+public:
+    // see BasicPerfTool::enableCounters()
+    bool enableCounters(const std::string &describe, const std::vector<PerfEvent> &events)
+    {
+        counters.reset(new PerfCounters(events));
+        if (!counters->isOpen())
+        {
+            LOG_WARN << describe << " can't open perf_event counters";
+            counters.reset();
+            return false;
+        }
+        counterBegin.assign(counters->size(), 0);
+        counterEnd.assign(counters->size(), 0);
+        counterHistograms.clear();
+        for (size_t i = 0; i < counters->size(); ++i)
+        {
+            counterHistograms.emplace_back(1, INT64_MAX / 2, 2);
+        }
+        counterSums.assign(counters->size(), 0);
+        LOG_INFO << describe << " counting " << counters->event(0).name << (counters->size() > 1 ? " ..." : "")
+                 << (counters->usesRdpmc() ? " with rdpmc" : " with read()");
+        return true;
+    }
 
-    double timeSum = (lhs.tv_sec + 1e-9 * lhs.tv_nsec) / rhs;
-    return {long(timeSum), long((timeSum - long(timeSum)) * 1e9)};
-}
+    // see BasicPerfTool::enableAllocations()
+    bool enableAllocations(const std::string &describe)
+    {
+        if (!allocHooksLinked.load(std::memory_order_relaxed))
+        {
+            LOG_WARN << describe << " can't count allocations, allocHooks.cpp isn't linked in";
+            return false;
+        }
+        allocationsHistogram.reset(new HdrHistogram(1, INT64_MAX / 2, 2));
+        allocatedHistogram.reset(new HdrHistogram(1, INT64_MAX / 2, 2));
+        freedHistogram.reset(new HdrHistogram(1, INT64_MAX / 2, 2));
+        bAllocations = true;
+        return true;
+    }
 
-static double operator*(const timespec &lhs, const timespec& rhs)
-{
-    
-    return (lhs.tv_sec + 1e-9 * lhs.tv_nsec) * (rhs.tv_sec + 1e-9*rhs.tv_nsec);
-}
-class PerfTool
+    // see BasicPerfTool::enableCpuSplit()
+    void enableCpuSplit(const bool bContextSwitches)
+    {
+        this->bContextSwitches = bContextSwitches;
+        onCpuHistogram.reset(new HdrHistogram(1, 3600LL * 1000000000, 2));
+        offCpuHistogram.reset(new HdrHistogram(1, 3600LL * 1000000000, 2));
+        bCpuSplit = true;
+    }
+
+    // right before the clock is read at begin(), the costliest probe first
+    void begin(void)
+    {
+        if (counters)
+        {
+            counters->read(counterBegin.data());
+        }
+        if (bCpuSplit)
+        {
+            readCpuSample(cpuBegin);
+        }
+        if (bAllocations)
+        {
+            allocBegin = threadAllocCounters;
+        }
+    }
+
+    // right after the clock is read at end(), in the reverse order
+    void end(void)
+    {
+        if (bAllocations)
+        {
+            allocEnd = threadAllocCounters;
+        }
+        if (bCpuSplit)
+        {
+            readCpuSample(cpuEnd);
+        }
+        if (counters)
+        {
+            counters->read(counterEnd.data());
+        }
+    }
+
+    // add the interval between the last begin() and end()
+    // wallTime: the interval in ns
+    void record(const uint64_t wallTime)
+    {
+        if (bCpuSplit)
+        {
+            const uint64_t onCpuTime = std::min(cpuEnd.cpuTime - cpuBegin.cpuTime, wallTime);
+            onCpuHistogram->record(onCpuTime);
+            offCpuHistogram->record(wallTime - onCpuTime);
+            voluntarySwitches += cpuEnd.voluntarySwitches - cpuBegin.voluntarySwitches;
+            involuntarySwitches += cpuEnd.involuntarySwitches - cpuBegin.involuntarySwitches;
+        }
+        if (counters)
+        {
+            for (size_t i = 0; i < counters->size(); ++i)
+            {
+                counterHistograms[i].record(int64_t(counterEnd[i] - counterBegin[i]));
+                counterSums[i] += counterEnd[i] - counterBegin[i];
+            }
+        }
+        if (bAllocations)
+        {
+            recordAllocations();
+        }
+    }
+
+    // everything recorded since the last full report, then start over
+    // timeScale, timeMessage: unit of the CPU split, see logMetricLine()
+    void log(const long timeScale, const std::string &timeMessage)
+    {
+        logCpuSplitInfo(timeScale, timeMessage);
+        logCounterInfo();
+        logAllocationInfo();
+    }
+
+private:
+    // hardware / software counters per interval
+    std::unique_ptr<PerfCounters> counters;
+    std::vector<uint64_t> counterBegin, counterEnd;
+    // per counter: distribution and sum of the deltas since the last full report
+    std::vector<HdrHistogram> counterHistograms;
+    std::vector<unsigned __int128> counterSums;
+
+    // heap allocations per interval
+    bool bAllocations = false;
+    AllocCounters allocBegin{0, 0, 0, 0}, allocEnd{0, 0, 0, 0};
+    // allocations, allocated bytes and freed bytes per call since the last full report
+    std::unique_ptr<HdrHistogram> allocationsHistogram, allocatedHistogram, freedHistogram;
+    unsigned __int128 allocationsSum = 0, allocatedSum = 0, freedSum = 0;
+
+    // on-CPU / off-CPU split
+    struct CpuSample
+    {
+        // CLOCK_THREAD_CPUTIME_ID ns
+        uint64_t cpuTime;
+        long voluntarySwitches, involuntarySwitches;
+    };
+    bool bCpuSplit = false, bContextSwitches = false;
+    CpuSample cpuBegin{}, cpuEnd{};
+    // in ns, since the last full report
+    std::unique_ptr<HdrHistogram> onCpuHistogram, offCpuHistogram;
+    uint64_t voluntarySwitches = 0, involuntarySwitches = 0;
+
+    void readCpuSample(CpuSample &sample)
+    {
+        sample.cpuTime = ThreadCpuClockPolicy::now();
+        if (bContextSwitches)
+        {
+            rusage usage;
+            getrusage(RUSAGE_THREAD, &usage);
+            sample.voluntarySwitches = usage.ru_nvcsw;
+            sample.involuntarySwitches = usage.ru_nivcsw;
+        }
+    }
+
+    // on-CPU and off-CPU time since the last full report, then start over
+    void logCpuSplitInfo(const long timeScale, const std::string &timeMessage)
+    {
+        if (!bCpuSplit || onCpuHistogram->count() == 0)
+        {
+            return;
+        }
+        logMetricLine("OnCPU Mean", onCpuHistogram->mean(), timeScale, timeMessage);
+        logMetricLine("OnCPU 99%", onCpuHistogram->valueAtQuantile(0.99), timeScale, timeMessage);
+        logMetricLine("OffCPU Mean", offCpuHistogram->mean(), timeScale, timeMessage);
+        logMetricLine("OffCPU 99%", offCpuHistogram->valueAtQuantile(0.99), timeScale, timeMessage);
+        logMetricLine("OffCPU Max", offCpuHistogram->max(), timeScale, timeMessage);
+        if (bContextSwitches)
+        {
+            LOG_INFO << "Context switches in " << onCpuHistogram->count() << " calls voluntary:" << voluntarySwitches
+                     << " involuntary:" << involuntarySwitches;
+        }
+        onCpuHistogram->reset();
+        offCpuHistogram->reset();
+        voluntarySwitches = 0, involuntarySwitches = 0;
+    }
+
+    void recordAllocations(void)
+    {
+        const uint64_t allocations = allocEnd.allocations - allocBegin.allocations;
+        const uint64_t allocated = allocEnd.allocatedBytes - allocBegin.allocatedBytes;
+        const uint64_t freed = allocEnd.freedBytes - allocBegin.freedBytes;
+        allocationsHistogram->record(int64_t(allocations));
+        allocatedHistogram->record(int64_t(allocated));
+        freedHistogram->record(int64_t(freed));
+        allocationsSum += allocations;
+        allocatedSum += allocated;
+        freedSum += freed;
+    }
+
+    // counters per call since the last full report, then start over
+    void logCounterInfo(void)
+    {
+        if (!counters || counterHistograms[0].count() == 0)
+        {
+            return;
+        }
+        const uint64_t calls = counterHistograms[0].count();
+        long double cycles = -1, instructions = -1;
+        for (size_t i = 0; i < counters->size(); ++i)
+        {
+            const std::string &name = counters->event(i).name;
+            LOG_INFO << name << " per call mean:" << fixedText(double((long double)counterSums[i] / calls), 2)
+                     << " 50%:" << counterHistograms[i].valueAtQuantile(0.5)
+                     << " 99%:" << counterHistograms[i].valueAtQuantile(0.99)
+                     << " max:" << counterHistograms[i].max();
+            cycles = name == "cycles" ? (long double)counterSums[i] : cycles;
+            instructions = name == "instructions" ? (long double)counterSums[i] : instructions;
+            counterHistograms[i].reset();
+            counterSums[i] = 0;
+        }
+        if (cycles > 0 && instructions >= 0)
+        {
+            LOG_INFO << "IPC:" << fixedText(double(instructions / cycles), 3);
+        }
+    }
+
+    // allocations per call since the last full report, then start over
+    void logAllocationInfo(void)
+    {
+        if (!bAllocations || allocationsHistogram->count() == 0)
+        {
+            return;
+        }
+        const uint64_t calls = allocationsHistogram->count();
+        LOG_INFO << "Allocations per call mean:" << fixedText(double((long double)allocationsSum / calls), 2)
+                 << " 50%:" << allocationsHistogram->valueAtQuantile(0.5)
+                 << " 99%:" << allocationsHistogram->valueAtQuantile(0.99)
+                 << " max:" << allocationsHistogram->max();
+        LOG_INFO << "Allocated bytes per call mean:" << fixedText(double((long double)allocatedSum / calls), 2)
+                 << " 50%:" << allocatedHistogram->valueAtQuantile(0.5)
+                 << " 99%:" << allocatedHistogram->valueAtQuantile(0.99)
+                 << " max:" << allocatedHistogram->max();
+        LOG_INFO << "Freed bytes per call mean:" << fixedText(double((long double)freedSum / calls), 2)
+                 << " 50%:" << freedHistogram->valueAtQuantile(0.5)
+                 << " 99%:" << freedHistogram->valueAtQuantile(0.99)
+                 << " max:" << freedHistogram->max();
+        allocationsHistogram->reset();
+        allocatedHistogram->reset();
+        freedHistogram->reset();
+        allocationsSum = allocatedSum = freedSum = 0;
+    }
+};
+
+// ClockPolicy: where timestamps come from, see perfToolPolicy.hpp
+// StatsPolicy: what is kept of the recorded intervals, see perfToolPolicy.hpp
+// with a disabled policy (NoopClockPolicy / NoopStatsPolicy) every call compiles to nothing
+template <class ClockPolicy, class StatsPolicy>
+class BasicPerfTool
 {
 private:
-    timespec beginTime = {0, 0}, endTime = {0, 0};
+    static constexpr bool enabled = ClockPolicy::enabled && StatsPolicy::enabled;
+
+    // raw clock ticks, converted to ns only when reporting
+    uint64_t beginTime = 0, endTime = 0;
+    // a tick and CLOCK_REALTIME ns read together, maps ticks to wall time
+    uint64_t tickBase = 0;
+    int64_t realtimeBase = 0;
     // paramaters initialize
-    const bool bUseCPUClock;
+    ClockPolicy clock;
     const int reportTimes, subReportTimes, windowSize;
 
     // control output
@@ -75,28 +347,116 @@ private:
     const long timeScale;
 
     // metrics initialize
-    std::multiset<timespec> windowTL;
-    std::vector<timespec> nextTL, lastTL;
+    StatsPolicy windowTL;
     int reportTimesCounter = 0, subReportTimesCounter = 0;
-    timespec sum, maxDeltaTime, minDeltaTime;
+    unsigned __int128 sum;
+    uint64_t maxDeltaTime, minDeltaTime;
+
+    // one measured interval, in ticks
+    // work: bytes / items handled in the interval, 0 if none
+    // context: user value passed to end(), kept with the slowest samples
+    // weight: calls the sample stands for, see setSampling()
+    struct Sample
+    {
+        uint64_t deltaTime, endTime, work, context;
+        uint32_t threadId, weight;
+    };
+
+    // async reporting, see startReporter()
+    // the measured thread fills a batch of samples and swaps it for an empty one,
+    // the reporter thread does all the statistics and logging
+    struct Batch
+    {
+        std::vector<Sample> samples;
+        size_t count = 0;
+        bool bForce = false, bAnalysis = false;
+    };
+    bool bAsync = false;
+    Batch *batch = nullptr;
+    // measured thread side: samples until the reporter has a full / sub report to make
+    int samplesToReport = 0, samplesToSubReport = 0;
+    std::vector<std::unique_ptr<Batch>> batches;
+    std::unique_ptr<SpscQueue<Batch *>> fullBatches, freeBatches;
+    std::atomic<uint64_t> droppedSamples{0};
+    uint64_t reportedDroppedSamples = 0;
+    std::atomic<bool> reporterStop{false};
+    std::thread reporter;
+
+    // cost of an empty begin() / end() pair in ticks, taken off every recorded interval, see calibrateOverhead()
+    uint64_t overheadTicks = 0;
+
+    // counters, CPU split and allocations per interval, created by the first enable call
+    std::unique_ptr<IntervalProbes> probes;
+
+    // coordinated omission correction, see setExpectedInterval()
+    // a second window next to windowTL, created when an expected interval is set
+    std::unique_ptr<StatsPolicy> correctedTL;
+    uint64_t expectedInterval = 0;
+
+    // sampling, see setSampling() / setAdaptiveSampling()
+    // begin() counts sampleCountdown down and only measures the call that reaches 0, the next
+    // countdown is drawn around sampleEvery with jitter; sampleEvery is moved by the reporter
+    // thread when adapting
+    // bSampling is false while every call is measured, begin() then skips the countdown and
+    // bSampled stays true
+    bool bSampling = false;
+    uint32_t sampleCountdown = 1, sampleLength = 1, sampleWeight = 1;
+    std::atomic<uint32_t> sampleEvery{1};
+    bool bSampled = true;
+    uint64_t sampleRandom = 0x9E3779B97F4A7C15ULL;
+    bool bAdaptiveSampling = false;
+    double sampleTarget = 0, sampleBudget = 0;
+    uint32_t sampleMinEvery = 1;
+    // ticks the sampled calls spent in the perf tool since the last full report
+    std::atomic<uint64_t> instrumentationTicks{0};
+    uint64_t clockPairTicks = 0, sampledSamples = 0;
+    // calls per sample of the last full report
+    double samplingRatio = 1;
+
+    // throughput since the last full report, see end(Work)
+    uint64_t throughputCalls = 0, throughputStart = 0;
+    unsigned __int128 throughputWork = 0;
+    // created by the first interval that carries work; time per unit is kept in 1/1000 ticks
+    std::unique_ptr<HdrHistogram> workHistogram, timePerUnitHistogram;
+    uint64_t pendingWork = 0, pendingContext = 0;
+    // rates of the last full report, see throughput()
+    double lastCallsPerSecond = 0, lastWorkPerSecond = 0, lastWorkPerCall = 0, lastNsPerUnit = 0;
+
+    // the slowest samples of the report window, see enableTopSamples()
+    // a min-heap on the duration, its root is the threshold a sample has to beat;
+    // the threshold stays at UINT64_MAX while disabled and is 0 until the heap is full
+    std::vector<Sample> topSamples;
+    size_t topCapacity = 0;
+    uint64_t topThreshold = UINT64_MAX;
+
+    // raw sample capture, see startCapture()
+    std::unique_ptr<TraceWriter> trace;
+    // event name in the ChromeTracer, UINT32_MAX if not traced, see enableChromeTrace()
+    uint32_t chromeTraceName = UINT32_MAX;
+
+    // machine readable reports, see setExporter()
+    Exporter *exporter = nullptr;
+    std::unique_ptr<Exporter> ownedExporter;
+    std::vector<double> exportValues;
+    // begin tick of the closed epochs in a count based window, the oldest one is where the window
+    // starts; a time based window has its own epoch boundaries, see StatsPolicy::windowBegin()
+    std::vector<uint64_t> epochBegins;
+    size_t epochHead = 0, closedEpochs = 0;
+    uint64_t openEpochBegin = 0, lastEndTime = 0;
 
     // log description information
     // subReport: report online metrics information
     void logDescribeInfo(const bool subReport = false)
     {
-        time_t tm;
-        time(&tm);
-        char tmp[64];
-        strftime(tmp, sizeof(tmp), "%Y-%m-%d %H:%M:%S", localtime(&tm));
-        LOG_INFO << '<' << tmp << "> " << describe << (subReport ? " sub report " : " ") << "statistics";
+        logDescribeLine(describe, subReport);
     }
 
     // log metrics information
     // metricName: the name of the metric
-    // metricData: the data of the metric
-    void logMetricInfo(const std::string &metricName, const timespec &metricData)
+    // metricData: the data of the metric in ticks
+    void logMetricInfo(const std::string &metricName, const double metricData)
     {
-        LOG_INFO << metricName << ":" << metricData.tv_sec << "s" << metricData.tv_nsec / timeScale << timeMessage;
+        logMetricLine(metricName, metricData * clock.nsPerTick(), timeScale, timeMessage);
     }
 
     // log online information
@@ -105,213 +465,378 @@ private:
         logDescribeInfo(true);
         logMetricInfo("Max", maxDeltaTime);
         logMetricInfo("Min", minDeltaTime);
-        logMetricInfo("Mean", sum / subReportTimes);
+        logMetricInfo("Mean", (long double)sum / subReportTimes);
+    }
+
+    // log a quantile of the window, followed by the corrected one when correcting
+    void logQuantileInfo(const std::string &metricName, const double quantile)
+    {
+        logMetricInfo(metricName, windowTL.valueAtQuantile(quantile));
+        if (correctedTL)
+        {
+            logMetricInfo(metricName + " corrected", correctedTL->valueAtQuantile(quantile));
+        }
     }
 
     // log all information
     void logInfo(void)
     {
-        // caculate mean
-        timespec timeSum = {0, 0};
-        // 去除最大值与最小值
-        auto iterBegin = windowTL.begin();
-        std::advance(iterBegin, 1);
-        auto iterEnd = windowTL.end();
-        std::advance(iterEnd, -1);
-        for (auto iter = iterBegin; iterBegin != iterEnd; std::advance(iterBegin, 1))
+        logDescribeInfo(false);
+        logQuantileInfo("Max", 1);
+        logQuantileInfo("Min", 0);
+        logMetricInfo("Mean", windowTL.mean());
+        if (correctedTL)
         {
-            timeSum = timeSum + *iter;
+            logMetricInfo("Mean corrected", correctedTL->mean());
         }
-        timespec timeMean = timeSum / (windowTL.size() - 2);
-
-        // caculate std
-        double timeStd = 0;
-        for (auto iter = iterBegin; iterBegin != iterEnd; std::advance(iterBegin, 1))
+        logMetricInfo("std", windowTL.stddev());
+        if (overheadTicks != 0)
         {
-            timeStd = timeStd + (*iter - timeMean) * (*iter - timeMean);
+            logMetricInfo("Overhead", overheadTicks);
+        }
+        if constexpr (StatsPolicy::hasQuantiles)
+        {
+            logQuantileInfo("99.99%", 0.9999);
+            logQuantileInfo("99.9%", 0.999);
+            logQuantileInfo("99%", 0.99);
+            logQuantileInfo("95%", 0.95);
+            logQuantileInfo("75%", 0.75);
+            logQuantileInfo("50%", 0.50);
+            logQuantileInfo("25%", 0.25);
+        }
+        if (correctedTL)
+        {
+            LOG_INFO << "Corrected samples:" << correctedTL->count() << " recorded:" << windowTL.count();
+        }
+        logTopSamples();
+        updateSampling(true);
+        logThroughputInfo();
+        if (probes)
+        {
+            probes->log(timeScale, timeMessage);
         }
-        timeStd = sqrt(timeStd / (windowTL.size() - 2));
-
-        logDescribeInfo(false);
-        logMetricInfo("Max", getTimeFromSet(1));
-        logMetricInfo("Min", getTimeFromSet(0));
-        logMetricInfo("Mean", timeSum / windowTL.size());
-        logMetricInfo("std", {long(timeStd), long((timeStd - long(timeStd)) * 1e9)});
-        logMetricInfo("95%", getTimeFromSet(0.95));
-        logMetricInfo("75%", getTimeFromSet(0.75));
-        logMetricInfo("50%", getTimeFromSet(0.50));
-        logMetricInfo("25%", getTimeFromSet(0.25));
     }
 
-    void logAnalysisInfo(void)
+    // the samples an open-loop generator firing every expectedInterval would have taken while
+    // this interval stalled it: deltaTime - expectedInterval, deltaTime - 2 * expectedInterval ...
+    // down to expectedInterval, as HdrHistogram's recordValueWithExpectedInterval does
+    void recordCorrected(const uint64_t deltaTime, const uint64_t intervalEnd)
     {
-        std::ofstream file(describe + ".json", std::ios::app);
-        cereal::JSONOutputArchive archive(file);
+        correctedTL->record(deltaTime, intervalEnd);
+        for (uint64_t missing = deltaTime; missing >= 2 * expectedInterval;)
+        {
+            missing -= expectedInterval;
+            correctedTL->record(missing, intervalEnd);
+        }
+    }
 
-        archive(cereal::make_nvp("Max", getTimeFromSet(1).tv_nsec),
-                cereal::make_nvp("Min", getTimeFromSet(0).tv_nsec),
-                cereal::make_nvp("95%", getTimeFromSet(0.95).tv_nsec),
-                cereal::make_nvp("75%", getTimeFromSet(0.75).tv_nsec),
-                cereal::make_nvp("50%", getTimeFromSet(0.50).tv_nsec),
-                cereal::make_nvp("25%", getTimeFromSet(0.25).tv_nsec));
+    // sample beat the threshold: push it, or replace the root once the heap is full
+    void recordTopSample(const Sample &sample, const uint64_t deltaTime)
+    {
+        auto longer = [](const Sample &a, const Sample &b)
+        { return a.deltaTime > b.deltaTime; };
+        if (topSamples.size() == topCapacity)
+        {
+            std::pop_heap(topSamples.begin(), topSamples.end(), longer);
+            topSamples.pop_back();
+        }
+        topSamples.push_back(sample);
+        topSamples.back().deltaTime = deltaTime;
+        std::push_heap(topSamples.begin(), topSamples.end(), longer);
+        if (topSamples.size() == topCapacity)
+        {
+            topThreshold = topSamples.front().deltaTime;
+        }
     }
 
-    // init all online Metrics
-    void initOnlineMetrics(void)
+    // the slowest samples of the window, slowest first
+    void logTopSamples(void)
     {
-        sum = {0, 0}, maxDeltaTime = {0, 0}, minDeltaTime = {LONG_MAX, 0};
+        if (topCapacity == 0 || topSamples.empty())
+        {
+            return;
+        }
+        std::sort(topSamples.begin(), topSamples.end(), [](const Sample &a, const Sample &b)
+                  { return a.deltaTime > b.deltaTime; });
+        for (size_t i = 0; i < topSamples.size(); ++i)
+        {
+            const Sample &sample = topSamples[i];
+            const int64_t beginNs = toRealtimeNs(sample.endTime - sample.deltaTime);
+            char begin[32];
+            snprintf(begin, sizeof(begin), "%lld.%09lld", (long long)(beginNs / 1000000000), (long long)(beginNs % 1000000000));
+            LOG_INFO << "Slowest " << i + 1 << ": " << uint64_t(sample.deltaTime * clock.nsPerTick()) << "ns begin:"
+                     << std::string(begin) << " thread:" << sample.threadId << " context:" << sample.context;
+        }
     }
 
-    // update the online metrics and add the counter
-    void updateOnlineMetrics(void)
+    // cost of an empty begin() / end() pair of this clock in ticks, the minimum or the median
+    uint64_t measureClockPair(const int samples, const bool bMedian)
     {
-        const struct timespec deltaTime = endTime - beginTime;
-        nextTL[reportTimesCounter] = deltaTime;
+        std::vector<uint64_t> deltas(std::max(samples, 1));
+        for (size_t i = 0; i < deltas.size() / 10; ++i)
+        {
+            clock.end(0);
+            clock.begin(0);
+        }
+        for (uint64_t &delta : deltas)
+        {
+            const uint64_t intervalBegin = clock.begin(0);
+            delta = clock.end(0) - intervalBegin;
+        }
+        std::sort(deltas.begin(), deltas.end());
+        return bMedian ? deltas[deltas.size() / 2] : deltas[0];
+    }
 
-        sum = sum + deltaTime;
-        maxDeltaTime = maxDeltaTime < deltaTime ? deltaTime : maxDeltaTime;
-        minDeltaTime = deltaTime < minDeltaTime ? deltaTime : minDeltaTime;
+    void recordChromeTrace(const uint64_t intervalBegin, const uint64_t intervalEnd)
+    {
+        ChromeTracer::instance().record(chromeTraceName, toRealtimeNs(intervalBegin),
+                                        int64_t((intervalEnd - intervalBegin) * clock.nsPerTick()));
+    }
 
-        if (++reportTimesCounter == reportTimes)
+    void recordWork(const uint64_t deltaTime, const uint64_t work, const uint32_t weight)
+    {
+        if (!workHistogram)
         {
-            reportTimesCounter = 0;
+            workHistogram.reset(new HdrHistogram(1, INT64_MAX / 2, 2));
+            timePerUnitHistogram.reset(new HdrHistogram(1, INT64_MAX / 2, 2));
         }
-        if (++subReportTimesCounter == subReportTimes)
+        throughputWork += (unsigned __int128)work * weight;
+        workHistogram->record(int64_t(std::min<uint64_t>(work, INT64_MAX / 2)));
+        timePerUnitHistogram->record(int64_t((unsigned __int128)deltaTime * 1000 / work));
+    }
+
+    // next countdown, uniform in [every - every / 2, every - every / 2 + every), xorshift64
+    uint32_t nextSampleLength(void)
+    {
+        const uint32_t every = sampleEvery.load(std::memory_order_relaxed);
+        if (every <= 1)
         {
-            subReportTimesCounter = 0;
+            return 1;
         }
+        sampleRandom ^= sampleRandom << 13;
+        sampleRandom ^= sampleRandom >> 7;
+        sampleRandom ^= sampleRandom << 17;
+        return every - every / 2 + uint32_t(sampleRandom % every);
     }
 
-    // update all metrics
-    void updateMetrics(void)
+    // the effective sampling rate since the last full report (scales the exported count), and
+    // the next one when adapting; logged when bLog, every full report calls it once before
+    // startWindow() starts the calls over
+    void updateSampling(const bool bLog)
     {
-        for (timespec &time : nextTL)
+        if (sampledSamples == 0)
         {
-            windowTL.insert(time);
+            return;
         }
-        if (windowTL.size() > windowSize)
+        samplingRatio = double(throughputCalls) / sampledSamples;
+        if (!bAdaptiveSampling)
         {
-            for (timespec &time : lastTL)
+            if (bLog && sampleEvery.load(std::memory_order_relaxed) > 1)
             {
-                windowTL.erase(windowTL.lower_bound(time));
+                LOG_INFO << "Sampling: 1 in " << fixedText(samplingRatio, 2) << " calls:" << throughputCalls << " samples:" << sampledSamples;
             }
+            sampledSamples = 0;
+            return;
+        }
+        const uint64_t elapsed = std::max<uint64_t>(lastEndTime - throughputStart, 1);
+        const double seconds = elapsed * clock.nsPerTick() / 1e9;
+        const double overhead = double(instrumentationTicks.exchange(0, std::memory_order_relaxed)) / elapsed;
+        const double callsPerSecond = throughputCalls / seconds;
+        // the rate that meets the target, and the one that keeps the overhead in the budget
+        double every = sampleMinEvery;
+        if (sampleTarget > 0)
+        {
+            every = std::max(every, callsPerSecond / sampleTarget);
         }
-        lastTL = nextTL;
+        if (sampleBudget > 0)
+        {
+            every = std::max(every, samplingRatio * overhead / sampleBudget);
+        }
+        const uint32_t next = uint32_t(std::min(every, double(1 << 24)) + 0.5);
+        sampleEvery.store(std::max<uint32_t>(next, 1), std::memory_order_relaxed);
+        if (bLog)
+        {
+            LOG_INFO << "Sampling: 1 in " << fixedText(samplingRatio, 2) << " calls:" << throughputCalls << " samples:" << sampledSamples
+                     << " overhead:" << fixedText(overhead * 100, 3) << "% next: 1 in " << std::max<uint32_t>(next, 1);
+        }
+        sampledSamples = 0;
     }
 
-    // be used in begin() and end() to get the time by function clock_gettime()
-    // selfTime: which paramater to store the time
-    void getTimeByFunction(timespec &selfTime)
+    // rates over the time since the last full report, work per call and time per unit;
+    // every full report calls it once before startWindow() starts them over
+    void updateThroughput(void)
     {
-        clock_gettime(CLOCK_REALTIME, &selfTime);
+        const double seconds = (lastEndTime - throughputStart) * clock.nsPerTick() / 1e9;
+        lastCallsPerSecond = 0, lastWorkPerSecond = 0, lastWorkPerCall = 0, lastNsPerUnit = 0;
+        if (throughputCalls == 0 || seconds <= 0)
+        {
+            return;
+        }
+        lastCallsPerSecond = throughputCalls / seconds;
+        if (workHistogram && workHistogram->count() != 0)
+        {
+            lastWorkPerSecond = double((long double)throughputWork / seconds);
+            lastWorkPerCall = workHistogram->mean();
+            lastNsPerUnit = timePerUnitHistogram->mean() * clock.nsPerTick() / 1000;
+        }
     }
 
-    // be used in begin() and end() to get the time by function rdtsc()
-    // selfTime: which paramater to store the time
-    void getTimeByRDTSC(timespec &selfTime)
+    void logThroughputInfo(void)
     {
-        __u64 timeFromRDTSC = rdtsc();
-        selfTime = {long(timeFromRDTSC / RDTSC_PARAMETER), long(timeFromRDTSC % RDTSC_PARAMETER)};
+        if (lastCallsPerSecond == 0)
+        {
+            return;
+        }
+        LOG_INFO << "Calls/s:" << fixedText(lastCallsPerSecond, 1);
+        if (lastWorkPerCall != 0)
+        {
+            LOG_INFO << "Work/s:" << fixedText(lastWorkPerSecond, 1);
+            LOG_INFO << "Work per call mean:" << fixedText(lastWorkPerCall, 2) << " 50%:" << workHistogram->valueAtQuantile(0.5)
+                     << " 99%:" << workHistogram->valueAtQuantile(0.99) << " max:" << workHistogram->max();
+            const double nsPerMilliTick = clock.nsPerTick() / 1000;
+            LOG_INFO << "Time per unit (ns) mean:" << fixedText(lastNsPerUnit, 3)
+                     << " 50%:" << fixedText(timePerUnitHistogram->valueAtQuantile(0.5) * nsPerMilliTick, 3)
+                     << " 99%:" << fixedText(timePerUnitHistogram->valueAtQuantile(0.99) * nsPerMilliTick, 3)
+                     << " max:" << fixedText(timePerUnitHistogram->max() * nsPerMilliTick, 3);
+        }
     }
 
-    timespec getTimeFromSet(const double percent)
+    // what is kept per full report starts over: calls, work and the slowest samples
+    void startWindow(void)
     {
-        return *next(windowTL.begin(), (windowTL.size() - 1) * percent);
+        throughputCalls = 0;
+        throughputWork = 0;
+        if (workHistogram)
+        {
+            workHistogram->reset();
+            timePerUnitHistogram->reset();
+        }
+        if (topCapacity != 0)
+        {
+            topSamples.clear();
+            topThreshold = 0;
+        }
     }
 
-public:
-    // unit == 0: use ns; 1: use us; 2: use ms; 3: use second
-    // bUse CPUClock == true: overwrite unit and use clock
-    // report: report all metrics
-    // subReport: report only online metrics
-    // reportTimes: reportTimes is window and keep a window size of time data
-    // rolkling: clear all time data if not rolling
-    // rollingWindowWize: if use rolling, control the rolling wiodow size
-    PerfTool(const char *describe,
-             int reportTimes,
-             int subReportTimes,
-             int rollingWindowSize = 0,
-             bool rolling = false,
-             int unit = 0,
-             bool bUseCPUClock = false)
-        : reportTimes(reportTimes),
-          subReportTimes(subReportTimes),
-          bUseCPUClock(bUseCPUClock),
-          describe(describe),
-          windowSize((reportTimes * (rolling ? ((rollingWindowSize - 1) / reportTimes + 1) : 1))),
-          timeMessage(TIME_MESSAGE_LIST[unit]),
-          timeScale(pow(1000, unit))
+    IntervalProbes &localProbes(void)
     {
-        nanolog::initialize(nanolog::GuaranteedLogger(), std::string(get_current_dir_name()) + '/', describe, 1);
-        lastTL.resize(reportTimes);
-        nextTL.resize(reportTimes);
-        initOnlineMetrics();
-    };
+        if (!probes)
+        {
+            probes.reset(new IntervalProbes());
+        }
+        return *probes;
+    }
 
-    // unit slave perf tool and append to master
-    PerfTool(const char *describe,
-             PerfTool *master)
-        : reportTimes(master->reportTimes),
-          subReportTimes(master->subReportTimes),
-          bUseCPUClock(master->bUseCPUClock),
-          windowSize(master->windowSize),
-          describe(describe),
-          timeScale(master->timeScale),
-          timeMessage(master->timeMessage)
+    int64_t toRealtimeNs(const uint64_t tick) const
     {
-        lastTL.resize(reportTimes);
-        nextTL.resize(reportTimes);
-        initOnlineMetrics();
-    };
+        return realtimeBase + int64_t(int64_t(tick - tickBase) * clock.nsPerTick());
+    }
 
-    ~PerfTool()
+    // hand the window to the exporter, if any
+    void exportInfo(void)
     {
-        std::vector<timespec>().swap(nextTL);
-    };
+        if (exporter == nullptr)
+        {
+            return;
+        }
+        const std::vector<double> &quantiles = exporter->quantiles();
+        exportValues.resize(quantiles.size());
+        for (size_t i = 0; i < quantiles.size(); ++i)
+        {
+            exportValues[i] = quantile(quantiles[i]);
+        }
+        // a time based window knows its epochs, a count based one closes an epoch per report
+        const int64_t timeWindowBegin = windowTL.windowBegin();
+        const uint64_t windowBegin = timeWindowBegin != 0                 ? uint64_t(timeWindowBegin)
+                                     : closedEpochs == 0                  ? lastEndTime
+                                     : closedEpochs < epochBegins.size() ? epochBegins[0]
+                                                                          : epochBegins[epochHead];
+        exporter->write({describe, int64_t(RealtimeClockPolicy::now()), toRealtimeNs(windowBegin), toRealtimeNs(lastEndTime),
+                         uint64_t(windowTL.count() * samplingRatio + 0.5), windowTL.mean() * clock.nsPerTick(), windowTL.stddev() * clock.nsPerTick(),
+                         quantile(0), quantile(1), overheadTicks * clock.nsPerTick(), exportValues.data()});
+    }
+
+    // the reference pair for toRealtimeNs() and the window bounds
+    void initTimeBase(const int epochs)
+    {
+        tickBase = clock.begin(0);
+        realtimeBase = RealtimeClockPolicy::now();
+        epochBegins.assign(std::max(epochs, 1), 0);
+    }
+
+    // init all online Metrics
+    void initOnlineMetrics(void)
+    {
+        sum = 0, maxDeltaTime = 0, minDeltaTime = UINT64_MAX;
+    }
 
-    // use parameter time if passed else get in function
-    // need an extreme fast implementation
-    void begin(uint64_t time = 0)
+    // update the online metrics and add the counter
+    // sample: the interval as measured, the overhead is taken off here; its end moves time based windows
+    void updateOnlineMetrics(const Sample &sample)
     {
-        if (time != 0)
+        const uint64_t measuredTime = sample.deltaTime, intervalEnd = sample.endTime, work = sample.work;
+        const uint64_t deltaTime = measuredTime > overheadTicks ? measuredTime - overheadTicks : 0;
+        if (deltaTime > topThreshold)
         {
-            beginTime = {long(time), 0};
+            recordTopSample(sample, deltaTime);
         }
-        else if (bUseCPUClock == false)
+        if (throughputCalls == 0)
         {
-            getTimeByFunction(beginTime);
+            throughputStart = intervalEnd - deltaTime;
         }
-        else
+        throughputCalls += sample.weight;
+        ++sampledSamples;
+        if (work != 0)
         {
-            getTimeByRDTSC(beginTime);
+            recordWork(deltaTime, work, sample.weight);
         }
-    }
+        windowTL.record(deltaTime, intervalEnd);
+        if (correctedTL)
+        {
+            recordCorrected(deltaTime, intervalEnd);
+        }
+        if (openEpochBegin == 0)
+        {
+            openEpochBegin = intervalEnd - deltaTime;
+        }
+        lastEndTime = intervalEnd;
 
-    void end(uint64_t time = 0)
-    {
-        if (time != 0)
+        sum += deltaTime;
+        maxDeltaTime = std::max(maxDeltaTime, deltaTime);
+        minDeltaTime = std::min(minDeltaTime, deltaTime);
+
+        if (++reportTimesCounter == reportTimes)
         {
-            endTime = {long(time), 0};
+            reportTimesCounter = 0;
         }
-        else if (bUseCPUClock == false)
+        if (++subReportTimesCounter == subReportTimes)
         {
-            getTimeByFunction(endTime);
+            subReportTimesCounter = 0;
         }
-        else
+    }
+
+    // update all metrics
+    // close the open epoch, the oldest one falls out of the window
+    void updateMetrics(void)
+    {
+        windowTL.advance();
+        if (correctedTL)
         {
-            getTimeByRDTSC(endTime);
+            correctedTL->advance();
         }
-    };
+        epochBegins[epochHead] = openEpochBegin;
+        epochHead = (epochHead + 1) % epochBegins.size();
+        closedEpochs = std::min(closedEpochs + 1, epochBegins.size());
+        openEpochBegin = 0;
+    }
 
-    // report was actuallly perform when the call times reaches (subReportTimes or reportTimes)
+    // log what is due after a sample was recorded
     // bForce: calculate and report immediately
-    void report(bool bForce = false)
+    void reportIfDue(bool bForce)
     {
-        updateOnlineMetrics();
         if (bForce == true || reportTimesCounter == 0)
         {
-            updateMetrics();
-            logInfo();
+            fullReport(false);
         }
         if (subReportTimesCounter == 0)
         {
@@ -321,17 +846,1217 @@ public:
             }
             initOnlineMetrics();
         }
-    };
+    }
 
-    // print with json format
-    // print with csv format
-    void analysisReport(bool bForce = false)
+    // record one interval and log what is due
+    // bForce: calculate and report immediately
+    // bAnalysis: report with analysisReport() instead of report()
+    void processSample(const Sample &sample, const bool bForce, const bool bAnalysis)
     {
-        updateOnlineMetrics();
-        if (bForce == true || reportTimesCounter == 0)
+        updateOnlineMetrics(sample);
+        if (!bAnalysis)
         {
-            updateMetrics();
-            logAnalysisInfo();
+            reportIfDue(bForce);
         }
-    };
-};
\ No newline at end of file
+        else if (bForce == true || reportTimesCounter == 0)
+        {
+            fullReport(true);
+        }
+    }
+
+    // close the window epoch, then log and export it, or only export it for analysisReport()
+    void fullReport(const bool bAnalysis)
+    {
+        updateMetrics();
+        updateThroughput();
+        if (!bAnalysis)
+        {
+            // logs the sampling rate in its place among the statistics
+            logInfo();
+        }
+        else
+        {
+            updateSampling(false);
+            if (exporter == nullptr)
+            {
+                ownedExporter.reset(new JsonLinesExporter(describe + ".jsonl"));
+                exporter = ownedExporter.get();
+            }
+        }
+        exportInfo();
+        startWindow();
+    }
+
+    // a forced report on a call that wasn't sampled: the window is reported without a new sample,
+    // inline or as an empty forced batch for the reporter thread
+    void submitFlush(const bool bAnalysis)
+    {
+        if (!bAsync)
+        {
+            fullReport(bAnalysis);
+            return;
+        }
+        if (batch == nullptr && !freeBatches->pop(batch))
+        {
+            droppedSamples.store(droppedSamples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        batch->bAnalysis = bAnalysis;
+        batch->bForce = true;
+        fullBatches->push(batch);
+        batch = nullptr;
+        freeBatches->pop(batch);
+    }
+
+    // process the sample inline, or hand it to the reporter thread
+    void submit(const Sample &sample, const bool bForce, const bool bAnalysis)
+    {
+        if (bAsync)
+        {
+            enqueue(sample, bForce, bAnalysis);
+        }
+        else
+        {
+            processSample(sample, bForce, bAnalysis);
+        }
+    }
+
+    // measured thread side of the async reporting: a store, and a pointer swap when the batch is full
+    // if the reporter thread is so far behind that no empty batch is left, the sample is dropped and counted
+    void enqueue(const Sample &sample, const bool bForce, const bool bAnalysis)
+    {
+        if (batch == nullptr && !freeBatches->pop(batch))
+        {
+            droppedSamples.store(droppedSamples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        batch->samples[batch->count++] = sample;
+        batch->bAnalysis = bAnalysis;
+        bool bReportDue = false;
+        if (--samplesToReport == 0)
+        {
+            samplesToReport = reportTimes;
+            bReportDue = true;
+        }
+        if (--samplesToSubReport == 0)
+        {
+            samplesToSubReport = subReportTimes;
+            bReportDue = true;
+        }
+        if (batch->count == batch->samples.size() || bForce || bReportDue)
+        {
+            batch->bForce = bForce;
+            fullBatches->push(batch);
+            batch = nullptr;
+            freeBatches->pop(batch);
+        }
+    }
+
+    // reporter thread side of the async reporting
+    void processBatch(Batch *full)
+    {
+        for (size_t i = 0; i < full->count; ++i)
+        {
+            processSample(full->samples[i], full->bForce && i + 1 == full->count, full->bAnalysis);
+        }
+        if (full->bForce && full->count == 0)
+        {
+            fullReport(full->bAnalysis);
+        }
+        full->count = 0;
+        full->bForce = false;
+        freeBatches->push(full);
+
+        uint64_t dropped = droppedSamples.load(std::memory_order_relaxed);
+        if (dropped != reportedDroppedSamples)
+        {
+            LOG_WARN << describe << " dropped " << dropped - reportedDroppedSamples << " samples, the reporter thread is behind";
+            reportedDroppedSamples = dropped;
+        }
+    }
+
+    void reporterLoop(void)
+    {
+        Batch *full;
+        while (true)
+        {
+            if (fullBatches->pop(full))
+            {
+                processBatch(full);
+            }
+            else if (reporterStop.load(std::memory_order_acquire))
+            {
+                while (fullBatches->pop(full))
+                {
+                    processBatch(full);
+                }
+                return;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    static ClockPolicy makeClock(bool bUseCPUClock)
+    {
+        if constexpr (std::is_constructible<ClockPolicy, bool>::value)
+        {
+            return ClockPolicy(bUseCPUClock);
+        }
+        else
+        {
+            return ClockPolicy();
+        }
+    }
+
+public:
+    // unit == 0: use ns; 1: use us; 2: use ms; 3: use second
+    // bUse CPUClock == true: use the calibrated TSC (falls back to CLOCK_MONOTONIC_RAW without an invariant TSC),
+    //                        only read by RuntimeClockPolicy
+    // report: report all metrics
+    // subReport: report only online metrics
+    // reportTimes: reportTimes is window and keep a window size of time data
+    // rolkling: clear all time data if not rolling
+    // rollingWindowWize: if use rolling, control the rolling wiodow size
+    // significantDigits: precision kept by the window histogram (1 ~ 5),
+    //                    the sketch keeps a relative error of 10^-significantDigits (also 1 ~ 5),
+    //                    up to 12KB per epoch at 2 digits and 115KB at 3, less over a narrow range, see ddSketch.hpp
+    // maxTrackableTime: longest interval the window can tell apart in ns, longer ones are clamped
+    // bUseSketch: keep the window in a DDSketch (bounded memory, mergeable) instead of a histogram,
+    //             only read by RuntimeStatsPolicy
+    // epochTime: 0 moves the window by one report batch at every report,
+    //            else the window holds (windowSize / reportTimes) epochs of epochTime ns
+    // bSubtractOverhead: run calibrateOverhead() now
+    BasicPerfTool(const char *describe,
+                  int reportTimes,
+                  int subReportTimes,
+                  int rollingWindowSize = 0,
+                  bool rolling = false,
+                  int unit = 0,
+                  bool bUseCPUClock = false,
+                  int significantDigits = 2,
+                  int64_t maxTrackableTime = 3600LL * 1000000000,
+                  bool bUseSketch = false,
+                  int64_t epochTime = 0,
+                  bool bSubtractOverhead = false)
+        : clock(makeClock(bUseCPUClock)),
+          reportTimes(reportTimes),
+          subReportTimes(subReportTimes),
+          windowSize((reportTimes * (rolling ? ((rollingWindowSize - 1) / reportTimes + 1) : 1))),
+          describe(describe),
+          timeMessage(TIME_MESSAGE_LIST[unit]),
+          timeScale(pow(1000, unit)),
+          windowTL(StatsOptions{windowSize, windowSize / reportTimes, int64_t(epochTime / clock.nsPerTick()),
+                                significantDigits, int64_t(maxTrackableTime / clock.nsPerTick()), bUseSketch})
+    {
+        if constexpr (enabled)
+        {
+            initializeLog(describe);
+            initTimeBase(windowSize / reportTimes);
+            if (bSubtractOverhead)
+            {
+                calibrateOverhead();
+            }
+        }
+        initOnlineMetrics();
+    };
+
+    // unit slave perf tool and append to master
+    BasicPerfTool(const char *describe,
+                  BasicPerfTool *master)
+        : clock(master->clock),
+          reportTimes(master->reportTimes),
+          subReportTimes(master->subReportTimes),
+          windowSize(master->windowSize),
+          describe(describe),
+          timeMessage(master->timeMessage),
+          timeScale(master->timeScale),
+          windowTL(master->windowTL)
+    {
+        windowTL.reset();
+        if constexpr (enabled)
+        {
+            exporter = master->exporter;
+            overheadTicks = master->overheadTicks;
+            initTimeBase(windowSize / reportTimes);
+        }
+        initOnlineMetrics();
+    };
+
+    ~BasicPerfTool()
+    {
+        stopReporter();
+    }
+
+    // move statistics and logging to a background thread
+    // afterwards end(token) / report() only store the sample into a batch, a batch goes through a
+    // lock-free queue to the reporter thread when it is full or its last sample makes a (sub) report due
+    // quantile() must not be called while the reporter thread runs
+    // batchCount: batches in flight, when all are full new samples are dropped and counted
+    // batchSize: samples per batch, of 40 bytes each, whatever the report windows are
+    void startReporter(int batchCount = 8, int batchSize = 4096)
+    {
+        if constexpr (enabled)
+        {
+            if (bAsync)
+            {
+                return;
+            }
+            batchCount = std::max(batchCount, 2);
+            batches.clear();
+            fullBatches.reset(new SpscQueue<Batch *>(batchCount));
+            freeBatches.reset(new SpscQueue<Batch *>(batchCount));
+            for (int i = 0; i < batchCount; ++i)
+            {
+                batches.emplace_back(new Batch());
+                batches.back()->samples.resize(std::max(batchSize, 1));
+                freeBatches->push(batches.back().get());
+            }
+            freeBatches->pop(batch);
+            samplesToReport = reportTimes - reportTimesCounter;
+            samplesToSubReport = subReportTimes - subReportTimesCounter;
+            reporterStop.store(false, std::memory_order_relaxed);
+            bAsync = true;
+            reporter = std::thread(&BasicPerfTool::reporterLoop, this);
+        }
+    }
+
+    // also read the thread's CPU time (and rusage) at begin() / end() and split every interval
+    // into on-CPU time and off-CPU time (descheduled, blocked on locks or I/O), logged with
+    // every full report; a lot of off-CPU time means waiting, not computing
+    // costs two clock_gettime(CLOCK_THREAD_CPUTIME_ID) (and two getrusage()) syscalls per interval
+    // only begin() / end() / report() intervals are split, not tokens, and not with startReporter()
+    // bContextSwitches: also count voluntary (blocking) and involuntary (preempted) context switches
+    void enableCpuSplit(bool bContextSwitches = true)
+    {
+        if constexpr (enabled)
+        {
+            localProbes().enableCpuSplit(bContextSwitches);
+        }
+    }
+
+    // read a perf_event group of the calling thread at begin() / end() and log, with every full
+    // report, the per call distribution of each counter (and IPC when cycles and instructions
+    // are counted); reads use rdpmc when the kernel allows it, else one syscall each
+    // only begin() / end() / report() intervals are counted, not tokens, and not with startReporter()
+    // events: empty for cycles, instructions, cache-misses and branch-misses, falling back to
+    //         task-clock, page-faults and context-switches when the PMU isn't exposed
+    // return false if no counter could be opened
+    bool enableCounters(const std::vector<PerfEvent> &events = {})
+    {
+        if constexpr (enabled)
+        {
+            return localProbes().enableCounters(describe, events);
+        }
+        return false;
+    }
+
+    // take the calling thread's heap allocation counters at begin() / end() and log, with every
+    // full report, the per call distribution of allocations, allocated bytes and freed bytes
+    // needs allocHooks.cpp linked into the program, reading the counters costs two copies
+    // only begin() / end() / report() intervals are counted, not tokens, and not with startReporter()
+    // return false if the allocation hooks aren't linked in
+    bool enableAllocations(void)
+    {
+        if constexpr (enabled)
+        {
+            return localProbes().enableAllocations(describe);
+        }
+        return false;
+    }
+
+    // measure the cost of an empty begin() / end() pair of this clock and take it off every
+    // interval recorded from now on (clamped at 0), so short intervals measure the code and
+    // not the clock reads; the figure is logged and exported with every report
+    // call before startReporter()
+    // samples: empty pairs measured
+    // bMedian: subtract the median instead of the minimum, the minimum never over-corrects
+    // return the overhead in ns
+    double calibrateOverhead(int samples = 10000, bool bMedian = false)
+    {
+        if constexpr (enabled)
+        {
+            overheadTicks = measureClockPair(samples, bMedian);
+            return overheadTicks * clock.nsPerTick();
+        }
+        return 0;
+    }
+
+    // measure only 1 in everyN calls: the others cost begin() a decrement and a branch, and
+    // end() / report() a branch; every sample stands for the calls since the previous one, so
+    // calls/s, work/s and the exported count are scaled back, the quantiles are those of the
+    // samples; the report batches count samples, full reports log the effective rate
+    // the countdown is drawn with jitter around everyN, so periodic workloads don't alias
+    // everyN: 1 measures every call, begin() then skips the countdown
+    void setSampling(uint32_t everyN)
+    {
+        if constexpr (enabled)
+        {
+            bAdaptiveSampling = false;
+            sampleEvery.store(std::max<uint32_t>(everyN, 1), std::memory_order_relaxed);
+            sampleCountdown = sampleLength = sampleWeight = 1;
+            bSampling = everyN > 1;
+            bSampled = true;
+        }
+    }
+
+    // sampling whose rate is adjusted at every full report: as few samples as samplesPerSecond
+    // needs, and no more than keep the time the sampled calls spend in the perf tool (measured:
+    // the clock pair plus everything after the end clock read, so also the full reports made on
+    // the measured thread without startReporter()) under overheadBudget
+    // call from the measured thread, before startReporter()
+    // samplesPerSecond: 0 for no target
+    // overheadBudget: share of the measured thread's time, e.g. 0.01; 0 for no budget
+    // minEveryN: sample at most 1 in minEveryN calls, also the rate it starts with
+    void setAdaptiveSampling(double samplesPerSecond, double overheadBudget = 0.01, uint32_t minEveryN = 1)
+    {
+        if constexpr (enabled)
+        {
+            setSampling(minEveryN);
+            clockPairTicks = measureClockPair(1000, true);
+            sampleTarget = samplesPerSecond;
+            sampleBudget = overheadBudget;
+            sampleMinEvery = std::max<uint32_t>(minEveryN, 1);
+            instrumentationTicks.store(0, std::memory_order_relaxed);
+            bAdaptiveSampling = true;
+            // the rate may rise at any full report
+            bSampling = true;
+        }
+    }
+
+    // keep the count slowest samples of every report window with their begin time, thread and
+    // the context passed to end(Context) / end(token, tag), and log them after the statistics
+    // a sample only costs one compare against the slowest-but-count-th duration, unless it beats it
+    // call before startReporter()
+    // count: 0 turns it off
+    void enableTopSamples(size_t count)
+    {
+        if constexpr (enabled)
+        {
+            topSamples.clear();
+            topSamples.reserve(count);
+            topCapacity = count;
+            topThreshold = count == 0 ? UINT64_MAX : 0;
+        }
+    }
+
+    // correct for coordinated omission: with a load generator issuing a request every
+    // expectedInterval, an interval longer than that stalled the requests behind it and they
+    // were never sampled; a second window back-fills them and every full report logs its
+    // percentiles next to the measured ones
+    // costs one extra record per expectedInterval of each interval, keep it to fixed-rate tests
+    // call before startReporter()
+    // expectedInterval: time between two requests in ns, 0 turns the correction off
+    void setExpectedInterval(uint64_t expectedInterval)
+    {
+        if constexpr (enabled)
+        {
+            this->expectedInterval = std::max<uint64_t>(1, uint64_t(expectedInterval / clock.nsPerTick()));
+            if (expectedInterval == 0)
+            {
+                correctedTL.reset();
+            }
+            else if (!correctedTL)
+            {
+                correctedTL.reset(new StatsPolicy(windowTL));
+                correctedTL->reset();
+            }
+        }
+    }
+
+    // also write every full report to exporter (JSON lines, CSV, Prometheus text, see exporter.hpp)
+    // exporter: not owned, must outlive this perf tool; one exporter can serve any number of perf tools
+    void setExporter(Exporter *exporter)
+    {
+        this->exporter = exporter;
+        ownedExporter.reset();
+    }
+
+    // while a ChromeTracer trace runs (ChromeTracer::instance().start()), also put every
+    // interval on its timeline as an event named after this perf tool, on the measuring thread
+    void enableChromeTrace(void)
+    {
+        if constexpr (enabled)
+        {
+            chromeTraceName = ChromeTracer::instance().name(describe);
+        }
+    }
+
+    // append every sample (start tick, duration, thread id, tag) to a preallocated, mmap'd
+    // trace file, on top of the usual statistics; read it back with perftool-dump
+    // capacity: records kept (32 bytes each), later samples overwrite the oldest ones
+    // return false if the file can't be created
+    bool startCapture(const std::string &path, uint64_t capacity = 1 << 20)
+    {
+        if constexpr (enabled)
+        {
+            trace.reset(new TraceWriter(path, describe, capacity, clock.nsPerTick(), tickBase, realtimeBase));
+            if (!trace->isOpen())
+            {
+                LOG_WARN << describe << " can't capture to " << path;
+                trace.reset();
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void stopCapture(void)
+    {
+        trace.reset();
+    }
+
+    // hand the last partial batch over and wait until the reporter thread has processed everything
+    void stopReporter(void)
+    {
+        if (!bAsync)
+        {
+            return;
+        }
+        if (batch != nullptr && batch->count != 0)
+        {
+            fullBatches->push(batch);
+        }
+        batch = nullptr;
+        reporterStop.store(true, std::memory_order_release);
+        reporter.join();
+        bAsync = false;
+    }
+
+    // timestamp handed out by begin() and consumed by end(token)
+    // one instance can time nested, recursive or overlapping intervals this way
+    // time: 0 if the call isn't sampled, see setSampling()
+    struct Token
+    {
+        uint64_t time;
+        uint32_t weight;
+    };
+
+    // work done by one interval (bytes, items, rows...) for end(Work), a type of its own so
+    // it can't be mistaken for a timestamp
+    struct Work
+    {
+        uint64_t amount;
+    };
+
+    // user value for end(Context), e.g. a request id
+    struct Context
+    {
+        uint64_t value;
+    };
+
+    // rates over the window of a full report, see throughput()
+    struct Throughput
+    {
+        double callsPerSecond, workPerSecond;
+        // work means of end(Work) calls only, 0 without them
+        double workPerCall, nsPerUnit;
+    };
+
+    // RAII guard: begin() on construction, end(token) on destruction
+    class Scope
+    {
+    public:
+        explicit Scope(BasicPerfTool &perfTool) : perfTool(perfTool), token(perfTool.begin()) {}
+        ~Scope() { perfTool.end(token); }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        BasicPerfTool &perfTool;
+        const Token token;
+    };
+
+    // use parameter time if passed else get in function, time is in the clock's ticks
+    // need an extreme fast implementation: only raw ticks are stored here
+    // the returned token can be passed to end(token) instead of calling end() and report()
+    Token begin(uint64_t time = 0)
+    {
+        if constexpr (enabled)
+        {
+            if (bSampling)
+            {
+                if (--sampleCountdown != 0)
+                {
+                    bSampled = false;
+                    return {0, 0};
+                }
+                bSampled = true;
+                sampleWeight = sampleLength;
+                sampleCountdown = sampleLength = nextSampleLength();
+            }
+            if (probes)
+            {
+                probes->begin();
+            }
+            beginTime = clock.begin(time);
+        }
+        return {beginTime, sampleWeight};
+    }
+
+    void end(uint64_t time = 0)
+    {
+        if constexpr (enabled)
+        {
+            if (!bSampled)
+            {
+                return;
+            }
+            endTime = clock.end(time);
+            if (probes)
+            {
+                probes->end();
+            }
+        }
+    };
+
+    // end() of an interval that handled work (bytes, items...), report() then also records the
+    // work: full reports add calls/s, work/s, the work per call and the time per unit of work
+    void end(Work work, uint64_t time = 0)
+    {
+        if constexpr (enabled)
+        {
+            end(time);
+            pendingWork = work.amount;
+        }
+    }
+
+    // end() with a user value (request id, key hash...) that report() keeps with the sample,
+    // it is logged if the sample is among the slowest ones, see enableTopSamples()
+    void end(Context context, uint64_t time = 0)
+    {
+        if constexpr (enabled)
+        {
+            end(time);
+            pendingContext = context.value;
+        }
+    }
+
+    // end the interval started by the begin() that returned token, record it and
+    // report if the call times reach (subReportTimes or reportTimes), like report()
+    // tag: stored with the sample in the trace file, see startCapture(), and the context
+    //      of the sample among the slowest ones, see enableTopSamples()
+    void end(const Token &token, uint64_t tag = 0)
+    {
+        end(token, Work{0}, tag);
+    }
+
+    // end(token) of an interval that handled work, see end(Work)
+    void end(const Token &token, Work work, uint64_t tag = 0)
+    {
+        if constexpr (enabled)
+        {
+            if (token.time == 0)
+            {
+                return;
+            }
+            const uint64_t intervalEnd = clock.end(0);
+            if (trace)
+            {
+                trace->record(token.time, intervalEnd - token.time, tag);
+            }
+            if (chromeTraceName != UINT32_MAX && ChromeTracer::instance().active())
+            {
+                recordChromeTrace(token.time, intervalEnd);
+            }
+            submit({intervalEnd - token.time, intervalEnd, work.amount, tag, TraceWriter::threadId(), token.weight}, false, false);
+            if (bAdaptiveSampling)
+            {
+                instrumentationTicks.fetch_add(clock.end(0) - intervalEnd + clockPairTicks, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // report was actuallly perform when the call times reaches (subReportTimes or reportTimes)
+    // bForce: calculate and report immediately
+    // with sampling, calls that weren't sampled return at once, a forced one still reports the window
+    void report(bool bForce = false)
+    {
+        if constexpr (enabled)
+        {
+            if (!bSampled)
+            {
+                if (bForce)
+                {
+                    submitFlush(false);
+                }
+                return;
+            }
+            if (trace)
+            {
+                trace->record(beginTime, endTime - beginTime, 0);
+            }
+            if (chromeTraceName != UINT32_MAX && ChromeTracer::instance().active())
+            {
+                recordChromeTrace(beginTime, endTime);
+            }
+            if (probes && !bAsync)
+            {
+                probes->record(uint64_t((endTime - beginTime) * clock.nsPerTick()));
+            }
+            submit({endTime - beginTime, endTime, pendingWork, pendingContext, TraceWriter::threadId(), sampleWeight}, bForce, false);
+            pendingWork = 0, pendingContext = 0;
+            if (bAdaptiveSampling)
+            {
+                instrumentationTicks.fetch_add(clock.end(0) - endTime + clockPairTicks, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // value of any quantile of the current window in ns
+    // percent: 0 ~ 1, 0 gives min and 1 gives max
+    double quantile(const double percent)
+    {
+        return windowTL.valueAtQuantile(percent) * clock.nsPerTick();
+    }
+
+    // samples in the coordinated omission corrected window, the recorded ones and the back-filled
+    // ones, 0 without setExpectedInterval()
+    uint64_t correctedCount(void) const
+    {
+        return correctedTL ? correctedTL->count() : 0;
+    }
+
+    // quantile() of the corrected window, 0 without setExpectedInterval()
+    double correctedQuantile(const double percent)
+    {
+        return correctedTL ? correctedTL->valueAtQuantile(percent) * clock.nsPerTick() : 0;
+    }
+
+    // the slowest samples since the last full report, slowest first: duration in ns and the
+    // context passed to end(Context) / end(token, tag); see enableTopSamples(), not with startReporter()
+    std::vector<std::pair<double, uint64_t>> slowestSamples(void) const
+    {
+        std::vector<Sample> sorted = topSamples;
+        std::sort(sorted.begin(), sorted.end(), [](const Sample &a, const Sample &b)
+                  { return a.deltaTime > b.deltaTime; });
+        std::vector<std::pair<double, uint64_t>> slowest;
+        for (const Sample &sample : sorted)
+        {
+            slowest.emplace_back(sample.deltaTime * clock.nsPerTick(), sample.context);
+        }
+        return slowest;
+    }
+
+    // rates of the last full report: calls and work per second, work per call and time per unit of work
+    Throughput throughput(void) const
+    {
+        return {lastCallsPerSecond, lastWorkPerSecond, lastWorkPerCall, lastNsPerUnit};
+    }
+
+    // like report(), but the window goes to the exporter only, no log text
+    // without setExporter() it is written as JSON lines to <describe>.jsonl
+    void analysisReport(bool bForce = false)
+    {
+        if constexpr (enabled)
+        {
+            if (!bSampled)
+            {
+                if (bForce)
+                {
+                    submitFlush(true);
+                }
+                return;
+            }
+            submit({endTime - beginTime, endTime, pendingWork, pendingContext, TraceWriter::threadId(), sampleWeight}, bForce, true);
+            pendingWork = 0, pendingContext = 0;
+        }
+    };
+};
+
+// the runtime configured PerfTool: clock picked by bUseCPUClock, statistics by bUseSketch
+using PerfTool = BasicPerfTool<RuntimeClockPolicy, RuntimeStatsPolicy>;
+// leave the instrumentation in place and compile it out
+using NoopPerfTool = BasicPerfTool<NoopClockPolicy, NoopStatsPolicy>;
+
+// process wide index of the calling thread, 0, 1, 2... in the order threads first ask
+static int threadIndex(void)
+{
+    static std::atomic<int> nextThreadIndex{0};
+    static thread_local const int index = nextThreadIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// PerfTool shared by many threads measuring the same code path
+// every thread records into its own cache line padded shard with plain relaxed
+// loads and stores (no lock, no read-modify-write), the shard counters only grow,
+// report() sums the growth of all shards since the last report into one histogram
+// a thread claims a shard at its first record and returns it when it exits, see ShardPool;
+// beyond maxThreads threads at once the extra ones share a shard with fetch_add (logged)
+class ConcurrentPerfTool
+{
+private:
+    struct alignas(64) Shard
+    {
+        // written by the owning thread only, or with fetch_add on the shared shard
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<uint64_t> sum{0};
+        char padding[64];
+
+        // reporter side: value of the counters at the last report
+        std::vector<uint64_t> lastCounts;
+        uint64_t lastSum = 0;
+    };
+
+    const bool bUseCPUClock;
+    const std::string describe, timeMessage;
+    const long timeScale;
+
+    HdrHistogram merged;
+    // maxThreads owned shards, then the shared one
+    std::vector<Shard> shards;
+    std::shared_ptr<ShardPool> pool;
+    std::mutex reportMutex;
+
+    std::thread reporter;
+    std::mutex reporterMutex;
+    std::condition_variable reporterCondition;
+    bool reporterStop = false;
+
+    // see setExporter(), the window of a report is the time since the previous one
+    Exporter *exporter = nullptr;
+    std::vector<double> exportValues;
+    int64_t lastReportTime;
+
+    uint64_t nowTicks(const bool bEnd)
+    {
+        if (bUseCPUClock)
+        {
+            return bEnd ? TscClock::endTicks() : TscClock::beginTicks();
+        }
+        return MonotonicClockPolicy::now();
+    }
+
+    double nsPerTick(void) const
+    {
+        return bUseCPUClock ? TscClock::ticksToNs(1) : 1;
+    }
+
+    void logMetricInfo(const std::string &metricName, const double metricData)
+    {
+        logMetricLine(metricName, metricData * nsPerTick(), timeScale, timeMessage);
+    }
+
+    // single writer, a plain load and store is enough and compiles to a mov
+    static void increase(std::atomic<uint64_t> &counter, const uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // fold the growth of every shard since the last collect() into merged
+    // return the exact sum of the new samples
+    uint64_t collect(void)
+    {
+        merged.reset();
+        uint64_t sumDelta = 0;
+        for (Shard &shard : shards)
+        {
+            for (size_t i = 0; i < shard.lastCounts.size(); ++i)
+            {
+                uint64_t current = shard.counts[i].load(std::memory_order_relaxed);
+                merged.addAtIndex(i, current - shard.lastCounts[i]);
+                shard.lastCounts[i] = current;
+            }
+            uint64_t currentSum = shard.sum.load(std::memory_order_relaxed);
+            sumDelta += currentSum - shard.lastSum;
+            shard.lastSum = currentSum;
+        }
+        return sumDelta;
+    }
+
+public:
+    // maxThreads: threads recording at once with a shard of their own, more share one shard
+    // unit == 0: use ns; 1: use us; 2: use ms; 3: use second
+    // bUseCPUClock == true: use the calibrated TSC, else CLOCK_MONOTONIC
+    // significantDigits, maxTrackableTime: parameters of the merged histogram
+    ConcurrentPerfTool(const char *describe,
+                       int maxThreads = 64,
+                       int unit = 0,
+                       bool bUseCPUClock = false,
+                       int significantDigits = 2,
+                       int64_t maxTrackableTime = 3600LL * 1000000000)
+        : bUseCPUClock(bUseCPUClock),
+          describe(describe),
+          timeMessage(TIME_MESSAGE_LIST[unit]),
+          timeScale(pow(1000, unit)),
+          merged(1, int64_t(maxTrackableTime / nsPerTick()), significantDigits),
+          shards(std::max(maxThreads, 1) + 1),
+          pool(std::make_shared<ShardPool>(describe, size_t(std::max(maxThreads, 1)))),
+          lastReportTime(int64_t(RealtimeClockPolicy::now()))
+    {
+        initializeLog(describe);
+        if (bUseCPUClock)
+        {
+            TscClock::reliable();
+        }
+        for (Shard &shard : shards)
+        {
+            shard.counts.reset(new std::atomic<uint64_t>[merged.countsLength()]());
+            shard.lastCounts.assign(merged.countsLength(), 0);
+        }
+    }
+
+    ~ConcurrentPerfTool()
+    {
+        stopReporter();
+    }
+
+    void begin(void)
+    {
+        localShardClaim(pool).beginTime = nowTicks(false);
+    }
+
+    void end(void)
+    {
+        uint64_t endTime = nowTicks(true);
+        const ShardClaim &claim = localShardClaim(pool);
+        record(claim, endTime - claim.beginTime);
+    }
+
+    // record an interval measured by the caller, in ticks of the clock (ns without bUseCPUClock)
+    void record(const uint64_t deltaTime)
+    {
+        record(localShardClaim(pool), deltaTime);
+    }
+
+    // merge all shards and log what was recorded since the last report
+    void report(void)
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        uint64_t sumDelta = collect();
+        logDescribeLine(describe, false);
+        LOG_INFO << "Count:" << merged.count();
+        logMetricInfo("Max", merged.max());
+        logMetricInfo("Min", merged.min());
+        logMetricInfo("Mean", merged.count() == 0 ? 0 : double(sumDelta) / merged.count());
+        logMetricInfo("std", merged.stddev());
+        logMetricInfo("99.9%", merged.valueAtQuantile(0.999));
+        logMetricInfo("99%", merged.valueAtQuantile(0.99));
+        logMetricInfo("95%", merged.valueAtQuantile(0.95));
+        logMetricInfo("75%", merged.valueAtQuantile(0.75));
+        logMetricInfo("50%", merged.valueAtQuantile(0.50));
+        logMetricInfo("25%", merged.valueAtQuantile(0.25));
+        if (pool->sharedThreads() != 0)
+        {
+            LOG_INFO << "Threads on the shared shard:" << pool->sharedThreads();
+        }
+
+        const int64_t now = int64_t(RealtimeClockPolicy::now());
+        if (exporter != nullptr)
+        {
+            const std::vector<double> &quantiles = exporter->quantiles();
+            exportValues.resize(quantiles.size());
+            for (size_t i = 0; i < quantiles.size(); ++i)
+            {
+                exportValues[i] = merged.valueAtQuantile(quantiles[i]) * nsPerTick();
+            }
+            exporter->write({describe, now, lastReportTime, now, merged.count(),
+                             (merged.count() == 0 ? 0 : double(sumDelta) / merged.count()) * nsPerTick(),
+                             merged.stddev() * nsPerTick(), merged.min() * nsPerTick(), merged.max() * nsPerTick(),
+                             0, exportValues.data()});
+        }
+        lastReportTime = now;
+    }
+
+    // also write every report to exporter, see exporter.hpp
+    // exporter: not owned, must outlive this perf tool
+    void setExporter(Exporter *exporter)
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        this->exporter = exporter;
+    }
+
+    // report every interval from a background thread
+    void startReporter(const std::chrono::milliseconds interval)
+    {
+        stopReporter();
+        reporterStop = false;
+        reporter = std::thread([this, interval]()
+                               {
+                                   std::unique_lock<std::mutex> lock(reporterMutex);
+                                   while (!reporterCondition.wait_for(lock, interval, [this]()
+                                                                      { return reporterStop; }))
+                                   {
+                                       report();
+                                   } });
+    }
+
+    void stopReporter(void)
+    {
+        if (reporter.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(reporterMutex);
+                reporterStop = true;
+            }
+            reporterCondition.notify_all();
+            reporter.join();
+        }
+    }
+
+private:
+    void record(const ShardClaim &claim, const uint64_t deltaTime)
+    {
+        Shard &shard = shards[claim.shard];
+        int64_t value = std::min<uint64_t>(deltaTime, merged.highestTrackable());
+        if (claim.bShared)
+        {
+            shard.counts[merged.countsIndex(value)].fetch_add(1, std::memory_order_relaxed);
+            shard.sum.fetch_add(value, std::memory_order_relaxed);
+            return;
+        }
+        increase(shard.counts[merged.countsIndex(value)], 1);
+        increase(shard.sum, value);
+    }
+};
+
+// end-to-end and per-stage latency of requests that cross threads (acceptor -> queue -> worker)
+// begin() hands out a Span, a 32-byte value to carry in the message; any thread can mark it:
+//   begin()            the request starts, its first stage (0) is in service
+//   enqueue(span)      the current stage is done, the request waits in a queue: records its service time
+//   hop(span, stage)   a thread takes the request for stage: records the queue wait of stage after
+//                      enqueue(), else (a stage following another on the same thread) the service
+//                      time of the previous stage
+//   end(span)          the request is done: records the service time of the current stage and the total
+// recording is lock-free like ConcurrentPerfTool: every thread writes its own padded shard of
+// histograms with relaxed loads and stores, claimed from a ShardPool at its first mark and
+// returned when it exits (beyond maxThreads threads at once the extra ones share a shard with
+// fetch_add), report() merges the growth since the last report
+// the clocks of all threads must agree: CLOCK_MONOTONIC, or the TSC when it is invariant
+class SpanPerfTool
+{
+public:
+    struct Span
+    {
+        // unique in the process: thread index + 1 in the top 24 bits, a per thread counter below
+        uint64_t id;
+        uint64_t beginTime, markTime;
+        uint32_t stage;
+        bool bQueued;
+    };
+
+    // one metric of a report, in ns
+    struct Summary
+    {
+        std::string name;
+        uint64_t count;
+        double mean, p50, p99, p999, max;
+    };
+
+    // stages: names of the stages, by index; the first one starts at begin(), empty is one "service" stage
+    // maxThreads: threads marking at once with a shard of their own, more share one shard
+    // unit == 0: use ns; 1: use us; 2: use ms; 3: use second
+    // bUseCPUClock == true: use the calibrated TSC, else CLOCK_MONOTONIC
+    SpanPerfTool(const char *describe,
+                 std::vector<std::string> stages,
+                 int maxThreads = 16,
+                 int unit = 0,
+                 bool bUseCPUClock = false,
+                 int significantDigits = 2,
+                 int64_t maxTrackableTime = 3600LL * 1000000000)
+        : bUseCPUClock(bUseCPUClock),
+          describe(describe),
+          timeMessage(TIME_MESSAGE_LIST[unit]),
+          timeScale(pow(1000, unit)),
+          stages(stages.empty() ? std::vector<std::string>{"service"} : std::move(stages)),
+          merged(1, int64_t(maxTrackableTime / nsPerTick()), significantDigits),
+          metricCount(1 + 2 * std::max<size_t>(this->stages.size(), 1)),
+          shards(std::max(maxThreads, 1) + 1),
+          pool(std::make_shared<ShardPool>(describe, size_t(std::max(maxThreads, 1))))
+    {
+        initializeLog(describe);
+        if (bUseCPUClock)
+        {
+            TscClock::reliable();
+        }
+        for (Shard &shard : shards)
+        {
+            shard.counts.reset(new std::atomic<uint64_t>[metricCount * merged.countsLength()]());
+            shard.sums.reset(new std::atomic<uint64_t>[metricCount]());
+            shard.lastCounts.assign(metricCount * merged.countsLength(), 0);
+            shard.lastSums.assign(metricCount, 0);
+        }
+    }
+
+    Span begin(void)
+    {
+        return begin(nowTicks(false));
+    }
+
+    // the calls taking now use it instead of the clock, in ticks of the tool's clock
+    // (ns unless bUseCPUClock), e.g. to replay timestamps taken elsewhere
+    Span begin(const uint64_t now)
+    {
+        static thread_local uint64_t nextId = 0;
+        return {uint64_t(threadIndex() + 1) << 40 | ++nextId, now, now, 0, false};
+    }
+
+    // the current stage of span is done, it waits for the next one
+    void enqueue(Span &span)
+    {
+        enqueue(span, nowTicks(true));
+    }
+
+    void enqueue(Span &span, const uint64_t now)
+    {
+        record(serviceMetric(span.stage), now, span.markTime);
+        span.markTime = now;
+        span.bQueued = true;
+    }
+
+    // stage takes span over
+    void hop(Span &span, uint32_t stage)
+    {
+        hop(span, stage, nowTicks(true));
+    }
+
+    void hop(Span &span, uint32_t stage, const uint64_t now)
+    {
+        const uint32_t previous = span.stage;
+        span.stage = std::min<uint32_t>(stage, uint32_t(stages.size() - 1));
+        record(span.bQueued ? waitMetric(span.stage) : serviceMetric(previous), now, span.markTime);
+        span.markTime = now;
+        span.bQueued = false;
+    }
+
+    void end(const Span &span)
+    {
+        end(span, nowTicks(true));
+    }
+
+    void end(const Span &span, const uint64_t now)
+    {
+        record(serviceMetric(span.stage), now, span.markTime);
+        record(0, now, span.beginTime);
+    }
+
+    // merge all shards and log what was recorded since the last report:
+    // end to end, then the queue wait and the service time of every stage
+    // return the logged metrics in the same order
+    std::vector<Summary> report(void)
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        logDescribeLine(describe, false);
+        std::vector<Summary> summaries;
+        summaries.push_back(logMetric("End to end", 0));
+        for (size_t stage = 0; stage < stages.size(); ++stage)
+        {
+            summaries.push_back(logMetric(stages[stage] + " wait", waitMetric(stage)));
+            summaries.push_back(logMetric(stages[stage] + " service", serviceMetric(stage)));
+        }
+        if (pool->sharedThreads() != 0)
+        {
+            LOG_INFO << "Threads on the shared shard:" << pool->sharedThreads();
+        }
+        return summaries;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        // written by the owning thread only, or with fetch_add on the shared shard,
+        // metricCount histograms one after the other
+        std::unique_ptr<std::atomic<uint64_t>[]> counts, sums;
+        char padding[64];
+
+        // reporter side: value of the counters at the last report
+        std::vector<uint64_t> lastCounts, lastSums;
+    };
+
+    const bool bUseCPUClock;
+    const std::string describe, timeMessage;
+    const long timeScale;
+    const std::vector<std::string> stages;
+    HdrHistogram merged;
+    // end to end, then wait and service of every stage
+    const size_t metricCount;
+    // maxThreads owned shards, then the shared one
+    std::vector<Shard> shards;
+    std::shared_ptr<ShardPool> pool;
+    std::mutex reportMutex;
+
+    static size_t waitMetric(size_t stage) { return 1 + 2 * stage; }
+
+    static size_t serviceMetric(size_t stage) { return 2 + 2 * stage; }
+
+    uint64_t nowTicks(const bool bEnd)
+    {
+        if (bUseCPUClock)
+        {
+            return bEnd ? TscClock::endTicks() : TscClock::beginTicks();
+        }
+        return MonotonicClockPolicy::now();
+    }
+
+    double nsPerTick(void) const
+    {
+        return bUseCPUClock ? TscClock::ticksToNs(1) : 1;
+    }
+
+    static void increase(std::atomic<uint64_t> &counter, const uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // a mark on another thread may read its clock a little after this one, clamp at 0
+    void record(const size_t metric, const uint64_t now, const uint64_t since)
+    {
+        const ShardClaim &claim = localShardClaim(pool);
+        Shard &shard = shards[claim.shard];
+        const int64_t value = std::min<int64_t>(int64_t(std::max(now, since) - since), merged.highestTrackable());
+        std::atomic<uint64_t> &count = shard.counts[metric * merged.countsLength() + merged.countsIndex(value)];
+        if (claim.bShared)
+        {
+            count.fetch_add(1, std::memory_order_relaxed);
+            shard.sums[metric].fetch_add(value, std::memory_order_relaxed);
+            return;
+        }
+        increase(count, 1);
+        increase(shard.sums[metric], value);
+    }
+
+    // fold the growth of metric in every shard since the last report into merged
+    // return the exact sum of the new samples
+    uint64_t collect(const size_t metric)
+    {
+        merged.reset();
+        uint64_t sumDelta = 0;
+        const size_t offset = metric * merged.countsLength();
+        for (Shard &shard : shards)
+        {
+            for (size_t i = 0; i < merged.countsLength(); ++i)
+            {
+                uint64_t current = shard.counts[offset + i].load(std::memory_order_relaxed);
+                merged.addAtIndex(i, current - shard.lastCounts[offset + i]);
+                shard.lastCounts[offset + i] = current;
+            }
+            uint64_t currentSum = shard.sums[metric].load(std::memory_order_relaxed);
+            sumDelta += currentSum - shard.lastSums[metric];
+            shard.lastSums[metric] = currentSum;
+        }
+        return sumDelta;
+    }
+
+    Summary logMetric(const std::string &name, const size_t metric)
+    {
+        const uint64_t sumDelta = collect(metric);
+        const double nsPerTick = this->nsPerTick();
+        LOG_INFO << name << " count:" << merged.count();
+        if (merged.count() == 0)
+        {
+            return {name, 0, 0, 0, 0, 0, 0};
+        }
+        const Summary summary{name, merged.count(), double(sumDelta) / merged.count() * nsPerTick,
+                              merged.valueAtQuantile(0.50) * nsPerTick, merged.valueAtQuantile(0.99) * nsPerTick,
+                              merged.valueAtQuantile(0.999) * nsPerTick, merged.max() * nsPerTick};
+        logMetricLine(name + " Mean", summary.mean, timeScale, timeMessage);
+        logMetricLine(name + " 50%", summary.p50, timeScale, timeMessage);
+        logMetricLine(name + " 99%", summary.p99, timeScale, timeMessage);
+        logMetricLine(name + " 99.9%", summary.p999, timeScale, timeMessage);
+        logMetricLine(name + " Max", summary.max, timeScale, timeMessage);
+        return summary;
+    }
+};
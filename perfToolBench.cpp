@@ -0,0 +1,262 @@
+// perftool_bench: what PerfTool itself costs
+// one JSON object per line on stdout, every time in ns
+// perftool_bench [iterations]
+#include "perfTool.cpp"
+#include <thread>
+
+#ifdef __GLIBC__
+// glibc's own malloc, under the hooks of allocHooks.cpp
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void __libc_free(void *block);
+#endif
+
+// latency of the empty measurement, taken off every sample
+static double baselineNs = 0;
+
+static void printResult(const std::string &bench, const std::string &name, const int iterations, HdrHistogram &histogram, const double batchMean)
+{
+    std::printf("{\"bench\":\"%s\",\"name\":\"%s\",\"iterations\":%d,\"mean\":%.2f,\"p50\":%lld,\"p90\":%lld,"
+                "\"p99\":%lld,\"p999\":%lld,\"max\":%lld,\"batch_mean\":%.2f}\n",
+                bench.c_str(), name.c_str(), iterations, histogram.mean(), (long long)histogram.valueAtQuantile(0.5),
+                (long long)histogram.valueAtQuantile(0.9), (long long)histogram.valueAtQuantile(0.99),
+                (long long)histogram.valueAtQuantile(0.999), (long long)histogram.max(), batchMean);
+    std::fflush(stdout);
+}
+
+// distribution of one call of function (each call timed on its own, baseline taken off)
+// and the mean of a batch of calls timed as a whole, which has no measurement overhead
+template <class Function>
+static void benchCalls(const std::string &bench, const std::string &name, const int iterations, Function function)
+{
+    HdrHistogram histogram(1, 1000000000LL, 3);
+    for (int i = 0; i < iterations / 10; ++i)
+    {
+        function();
+    }
+    for (int i = 0; i < iterations; ++i)
+    {
+        const uint64_t begin = TscClock::beginTicks();
+        function();
+        const uint64_t end = TscClock::endTicks();
+        histogram.record(int64_t(std::max(0.0, TscClock::ticksToNs(end - begin) - baselineNs) + 0.5));
+    }
+    const uint64_t begin = TscClock::beginTicks();
+    for (int i = 0; i < iterations; ++i)
+    {
+        function();
+    }
+    const double batchMean = TscClock::ticksToNs(TscClock::endTicks() - begin) / iterations;
+    printResult(bench, name, iterations, histogram, batchMean);
+}
+
+// begin() + end() + report() with a window that never reports, the cost every sample pays
+template <class Tool>
+static void benchTool(const std::string &name, const int iterations, Tool &tool)
+{
+    benchCalls("call", name, iterations, [&tool]()
+               {
+                   tool.begin();
+                   tool.end();
+                   tool.report(); });
+}
+
+// cost of the full report of a window holding windowSize samples in 10 epochs
+// the window is refilled before every measured report: only the last sample of each report
+// batch is timed, together with the full report it triggers, so every report sees a full window
+static void benchReport(const std::string &name, const int windowSize, const bool bUseSketch, const int iterations)
+{
+    const int reportTimes = std::max(windowSize / 10, 1);
+    PerfTool tool(("bench report " + name).c_str(), reportTimes, reportTimes, windowSize, true, 0, true, 2,
+                  3600LL * 1000000000, bUseSketch);
+    auto sample = [&tool]()
+    {
+        tool.begin();
+        tool.end();
+        tool.report();
+    };
+    for (int i = 0; i < windowSize - 1; ++i)
+    {
+        sample();
+    }
+    HdrHistogram histogram(1, 1000000000LL, 3);
+    for (int i = 0; i < iterations; ++i)
+    {
+        const uint64_t begin = TscClock::beginTicks();
+        sample();
+        const uint64_t end = TscClock::endTicks();
+        histogram.record(int64_t(std::max(0.0, TscClock::ticksToNs(end - begin) - baselineNs) + 0.5));
+        for (int j = 0; j < reportTimes - 1; ++j)
+        {
+            sample();
+        }
+    }
+    printResult("report", name + " window " + std::to_string(windowSize), iterations, histogram, histogram.mean());
+}
+
+// ConcurrentPerfTool begin() + end() from threads threads at once
+static void benchThreads(const int threads, const int iterations)
+{
+    ConcurrentPerfTool tool("bench concurrent", 64, 0, true);
+    std::vector<std::thread> workers;
+    std::vector<double> nsPerCall(threads);
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&tool, &nsPerCall, t, iterations]()
+                             {
+                                 const uint64_t begin = TscClock::beginTicks();
+                                 for (int i = 0; i < iterations; ++i)
+                                 {
+                                     tool.begin();
+                                     tool.end();
+                                 }
+                                 nsPerCall[t] = TscClock::ticksToNs(TscClock::endTicks() - begin) / iterations; });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    HdrHistogram histogram(1, 1000000000LL, 3);
+    for (double ns : nsPerCall)
+    {
+        histogram.record(int64_t(ns + 0.5));
+    }
+    // across threads: distribution of the per thread mean
+    std::printf("{\"bench\":\"threads\",\"name\":\"concurrent begin+end\",\"threads\":%d,\"iterations\":%d,"
+                "\"mean\":%.2f,\"max\":%lld,\"calls_per_second\":%.0f}\n",
+                threads, iterations, histogram.mean(), (long long)histogram.max(), threads * 1e9 / histogram.mean());
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const int iterations = argc > 1 ? std::max(std::atoi(argv[1]), 100) : 1000000;
+    // report batches large enough that nothing is logged while measuring
+    const int quiet = 1 << 30;
+
+    HdrHistogram baseline(1, 1000000000LL, 3);
+    for (int i = 0; i < iterations; ++i)
+    {
+        const uint64_t begin = TscClock::beginTicks();
+        const uint64_t end = TscClock::endTicks();
+        baseline.record(int64_t(TscClock::ticksToNs(end - begin) + 0.5));
+    }
+    baselineNs = baseline.valueAtQuantile(0.5);
+    std::printf("{\"bench\":\"baseline\",\"tsc\":%s,\"ns_per_tick\":%.6f,\"empty_measurement\":%.0f}\n",
+                TscClock::reliable() ? "true" : "false", TscClock::ticksToNs(1), baselineNs);
+
+    // what calibrateOverhead() takes off every interval, minimum and median
+    auto printOverhead = [](const std::string &name, auto &tool)
+    {
+        const double minimum = tool.calibrateOverhead(100000, false), median = tool.calibrateOverhead(100000, true);
+        std::printf("{\"bench\":\"overhead\",\"name\":\"%s\",\"min\":%.1f,\"median\":%.1f}\n", name.c_str(), minimum, median);
+    };
+
+    // clock sources and statistics backends
+    PerfTool runtimeMonotonic("bench runtime monotonic hdr", quiet, quiet, 0, false, 0, false);
+    benchTool("runtime monotonic/hdr", iterations, runtimeMonotonic);
+    PerfTool tscHistogram("bench tsc hdr", quiet, quiet, 0, false, 0, true);
+    benchTool("tsc/hdr", iterations, tscHistogram);
+    PerfTool tscSketch("bench tsc sketch", quiet, quiet, 0, false, 0, true, 2, 3600LL * 1000000000, true);
+    benchTool("tsc/sketch", iterations, tscSketch);
+    BasicPerfTool<TscClockPolicy, HistogramStatsPolicy> tscPolicy("bench tsc policy", quiet, quiet);
+    benchTool("policy tsc/hdr", iterations, tscPolicy);
+    BasicPerfTool<TscClockPolicy, MinMaxMeanStatsPolicy> minMaxMean("bench tsc minmaxmean", quiet, quiet);
+    benchTool("policy tsc/minmaxmean", iterations, minMaxMean);
+    BasicPerfTool<MonotonicClockPolicy, HistogramStatsPolicy> monotonic("bench monotonic hdr", quiet, quiet);
+    benchTool("policy monotonic/hdr", iterations, monotonic);
+    BasicPerfTool<ThreadCpuClockPolicy, HistogramStatsPolicy> threadCpu("bench thread cpu hdr", quiet, quiet);
+    benchTool("policy threadcpu/hdr", iterations, threadCpu);
+    // the raw capture window holds every sample of a report batch
+    BasicPerfTool<TscClockPolicy, RawCaptureStatsPolicy> rawCapture("bench tsc raw", 1 << 22, 1 << 22);
+    benchTool("policy tsc/raw", iterations, rawCapture);
+    PerfTool counters("bench tsc counters", quiet, quiet, 0, false, 0, true);
+    if (counters.enableCounters())
+    {
+        benchTool("tsc/hdr counters", iterations, counters);
+    }
+    // drops once the buffer is full between two flushes, the same cost as a recorded event
+    PerfTool chromeTrace("bench tsc chrome trace", quiet, quiet, 0, false, 0, true);
+    chromeTrace.enableChromeTrace();
+    ChromeTracer::instance().start("bench.trace.json", std::chrono::milliseconds(0), 1 << 16, std::chrono::milliseconds(100), false);
+    benchTool("tsc/hdr chrome trace", iterations, chromeTrace);
+    ChromeTracer::instance().stop();
+    printOverhead("runtime monotonic", runtimeMonotonic);
+    printOverhead("tsc", tscHistogram);
+    printOverhead("monotonic", monotonic);
+    printOverhead("threadcpu", threadCpu);
+    NoopPerfTool noop("bench noop", quiet, quiet);
+    benchTool("noop", iterations, noop);
+
+    PerfTool token("bench token", quiet, quiet, 0, false, 0, true);
+    benchCalls("call", "tsc/hdr token", iterations, [&token]()
+               { token.end(token.begin()); });
+    // 1 in 64 calls measured, the others only count down
+    PerfTool sampled("bench sampled", quiet, quiet, 0, false, 0, true);
+    sampled.setSampling(64);
+    benchTool("tsc/hdr sampled 1/64", iterations, sampled);
+    PerfTool async("bench async", 1000, 1000, 0, false, 0, true);
+    async.startReporter(64);
+    benchTool("tsc/hdr async", iterations, async);
+    async.stopReporter();
+    ConcurrentPerfTool concurrent("bench concurrent", 64, 0, true);
+    benchCalls("call", "concurrent tsc", iterations, [&concurrent]()
+               {
+                   concurrent.begin();
+                   concurrent.end(); });
+    SpanPerfTool spans("bench span", {"accept", "work"});
+    benchCalls("call", "span begin+enqueue+hop+end", iterations, [&spans]()
+               {
+                   SpanPerfTool::Span span = spans.begin();
+                   spans.enqueue(span);
+                   spans.hop(span, 1);
+                   spans.end(span); });
+    // what the allocation hooks add to every allocation, compared with glibc itself
+#ifdef __GLIBC__
+    benchCalls("call", "libc malloc+free", iterations, []()
+               { __libc_free(__libc_malloc(64)); });
+#endif
+    benchCalls("call", "hooked malloc+free", iterations, []()
+               {
+                   void *volatile block = std::malloc(64);
+                   std::free(block); });
+    PerfTool allocations("bench tsc allocations", quiet, quiet, 0, false, 0, true);
+    if (allocations.enableAllocations())
+    {
+        benchTool("tsc/hdr allocations", iterations, allocations);
+    }
+    static const int timer = TimerRegistry::instance().timer("bench");
+    benchCalls("call", "timer scope", iterations, []()
+               { TimerScope scope(timer); });
+
+    // labeled records spread over 10k keys
+    LabeledPerfTool labeled(10000);
+    std::vector<uint64_t> keys;
+    for (int i = 0; i < 10000; ++i)
+    {
+        keys.push_back(LabeledPerfTool::key(LabeledPerfTool::label("bench label " + std::to_string(i))));
+    }
+    size_t next = 0;
+    benchCalls("call", "labeled 10k keys", iterations, [&labeled, &keys, &next]()
+               {
+                   labeled.end(keys[next], labeled.begin());
+                   next = next + 1 == keys.size() ? 0 : next + 1; });
+    std::printf("{\"bench\":\"memory\",\"name\":\"labeled\",\"keys\":%zu,\"bytes\":%zu}\n", labeled.size(), labeled.memoryBytes());
+    // footprint of a perf tool object before any window memory, a disabled one keeps its fields
+    std::printf("{\"bench\":\"memory\",\"name\":\"perf tool\",\"bytes\":%zu}\n", sizeof(PerfTool));
+    std::printf("{\"bench\":\"memory\",\"name\":\"noop perf tool\",\"bytes\":%zu}\n", sizeof(NoopPerfTool));
+
+    // report cost versus window size
+    for (int windowSize : {1000, 10000, 100000})
+    {
+        benchReport("hdr", windowSize, false, 100);
+        benchReport("sketch", windowSize, true, 100);
+    }
+
+    // multi-threaded scaling
+    const int maxThreads = std::max(4, int(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        benchThreads(threads, iterations);
+    }
+    return 0;
+}
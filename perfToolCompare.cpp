@@ -0,0 +1,442 @@
+// perftool-compare: A/B comparison of two runs captured with PerfTool::startCapture()
+// perftool-compare [-q quantiles] [-b resamples] [-a alpha] [-r regression%] [-j threads] [-t tag] <baseline> <candidate>
+// baseline / candidate: a trace file, or a directory whose *.trace files are paired by perf tool name
+// (several files of one name are merged); two plain files are compared whatever their names
+// every input is streamed once into a histogram (3 significant digits), everything after that
+// works on the buckets, so the size of the runs only costs the reading
+// exit code: 0 no regression, 1 a significant regression, 2 bad arguments or inputs
+#include "traceFile.hpp"
+#include "hdrHistogram.hpp"
+#include <map>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-q quantiles] [-b resamples] [-a alpha] [-r regression%%] [-j threads] [-t tag] <baseline> <candidate>\n"
+                    "  -q  comma separated percentiles (default 50,90,99,99.9)\n"
+                    "  -b  bootstrap resamples (default 1000)\n"
+                    "  -a  significance level of the tests and 1 - confidence of the intervals (default 0.01)\n"
+                    "  -r  smallest slowdown of a percentile in %% that counts as a regression (default 5)\n"
+                    "  -j  resampling threads (default: all cores)\n"
+                    "  -t  only read records with this tag\n"
+                    "  baseline, candidate: trace files, or directories of them paired by name\n"
+                    "exit status: 0 no regression, 1 regression, 2 bad arguments or inputs, a timer missing in one run included\n",
+            program);
+}
+
+// text is one finite number and nothing else
+static bool parseNumber(const std::string &text, double &value)
+{
+    char *end;
+    value = strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+// comma separated percentiles, each one in 0 ~ 100, as quantiles
+static bool parseQuantiles(const std::string &text, std::vector<double> &quantiles)
+{
+    quantiles.clear();
+    for (size_t begin = 0;;)
+    {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        double percentile;
+        if (!parseNumber(text.substr(begin, end - begin), percentile) || percentile < 0 || percentile > 100)
+        {
+            return false;
+        }
+        quantiles.push_back(percentile / 100);
+        if (end == text.size())
+        {
+            return true;
+        }
+        begin = end + 1;
+    }
+}
+
+static HdrHistogram makeHistogram(void)
+{
+    return HdrHistogram(1, 3600LL * 1000000000, 3);
+}
+
+// name -> histogram of the durations in ns of every trace file of that name
+// return false if a path can't be read
+static bool readRun(const std::string &path, const bool bFilterTag, const uint64_t tag, std::map<std::string, HdrHistogram> &run)
+{
+    std::vector<std::string> files;
+    struct stat status;
+    if (stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode))
+    {
+        DIR *directory = opendir(path.c_str());
+        if (directory == nullptr)
+        {
+            return false;
+        }
+        while (dirent *entry = readdir(directory))
+        {
+            const std::string file = entry->d_name;
+            if (file.size() > 6 && file.compare(file.size() - 6, 6, ".trace") == 0)
+            {
+                files.push_back(path + '/' + file);
+            }
+        }
+        closedir(directory);
+        if (files.empty())
+        {
+            fprintf(stderr, "%s holds no trace files\n", path.c_str());
+            return false;
+        }
+    }
+    else
+    {
+        files.push_back(path);
+    }
+    for (const std::string &file : files)
+    {
+        TraceReader reader(file);
+        if (!reader.isOpen())
+        {
+            fprintf(stderr, "%s is not a readable trace file\n", file.c_str());
+            return false;
+        }
+        HdrHistogram &histogram = run.emplace(reader.info().name, makeHistogram()).first->second;
+        for (uint64_t i = 0; i < reader.size(); ++i)
+        {
+            const TraceRecord &record = reader.at(i);
+            if (!bFilterTag || record.tag == tag)
+            {
+                histogram.record(int64_t(reader.toNs(record.durationTicks) + 0.5));
+            }
+        }
+    }
+    return true;
+}
+
+// the non-empty buckets of a histogram, ascending
+struct Buckets
+{
+    std::vector<uint64_t> counts;
+    std::vector<int64_t> values;
+};
+
+static Buckets nonEmptyBuckets(const HdrHistogram &histogram)
+{
+    Buckets buckets;
+    for (size_t i = 0; i < histogram.countsLength(); ++i)
+    {
+        if (histogram.countAtIndex(i) != 0)
+        {
+            buckets.counts.push_back(histogram.countAtIndex(i));
+            buckets.values.push_back(histogram.highestEquivalentValue(histogram.valueFromIndex(i)));
+        }
+    }
+    return buckets;
+}
+
+// values at the quantiles (ascending) of buckets weighted by weights, in one pass
+static void weightedQuantiles(const Buckets &buckets, const std::vector<uint64_t> &weights, const std::vector<double> &quantiles, double *values)
+{
+    uint64_t total = 0;
+    for (uint64_t weight : weights)
+    {
+        total += weight;
+    }
+    uint64_t seen = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < weights.size() && q < quantiles.size(); ++i)
+    {
+        seen += weights[i];
+        while (q < quantiles.size() && seen >= std::max<uint64_t>(1, uint64_t(quantiles[q] * total + 0.5)))
+        {
+            values[q++] = double(buckets.values[i]);
+        }
+    }
+    for (; q < quantiles.size(); ++q)
+    {
+        values[q] = buckets.values.empty() ? 0 : double(buckets.values.back());
+    }
+}
+
+// Poisson bootstrap: a resample weighs every bucket with Poisson(count), the same as drawing
+// every sample Poisson(1) times, so a resample costs O(buckets) and not O(samples)
+// return resamples x quantiles relative changes (candidate / baseline - 1), resample major
+static std::vector<double> bootstrap(const Buckets &baseline, const Buckets &candidate, const std::vector<double> &quantiles,
+                                     const int resamples, const int threads)
+{
+    std::vector<double> changes(size_t(resamples) * quantiles.size());
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+                             {
+                                 std::mt19937_64 random(0x5eed + t);
+                                 using Poisson = std::poisson_distribution<uint64_t>;
+                                 std::vector<Poisson::param_type> baselineParams, candidateParams;
+                                 for (uint64_t count : baseline.counts)
+                                 {
+                                     baselineParams.emplace_back(double(count));
+                                 }
+                                 for (uint64_t count : candidate.counts)
+                                 {
+                                     candidateParams.emplace_back(double(count));
+                                 }
+                                 Poisson poisson;
+                                 std::vector<uint64_t> baselineWeights(baseline.counts.size()), candidateWeights(candidate.counts.size());
+                                 std::vector<double> baselineValues(quantiles.size()), candidateValues(quantiles.size());
+                                 for (int r = t; r < resamples; r += threads)
+                                 {
+                                     for (size_t i = 0; i < baselineWeights.size(); ++i)
+                                     {
+                                         baselineWeights[i] = poisson(random, baselineParams[i]);
+                                     }
+                                     for (size_t i = 0; i < candidateWeights.size(); ++i)
+                                     {
+                                         candidateWeights[i] = poisson(random, candidateParams[i]);
+                                     }
+                                     weightedQuantiles(baseline, baselineWeights, quantiles, baselineValues.data());
+                                     weightedQuantiles(candidate, candidateWeights, quantiles, candidateValues.data());
+                                     for (size_t q = 0; q < quantiles.size(); ++q)
+                                     {
+                                         changes[size_t(r) * quantiles.size() + q] =
+                                             baselineValues[q] == 0 ? 0 : candidateValues[q] / baselineValues[q] - 1;
+                                     }
+                                 } });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    return changes;
+}
+
+// Mann-Whitney U of candidate against baseline on the shared bucket layout, values in one
+// bucket count as ties; return the two-sided p value, z > 0 means the candidate is slower
+static double mannWhitney(const HdrHistogram &baseline, const HdrHistogram &candidate, double &z)
+{
+    const long double n1 = baseline.count(), n2 = candidate.count(), n = n1 + n2;
+    long double u = 0, tieTerm = 0, baselineBelow = 0;
+    for (size_t i = 0; i < baseline.countsLength(); ++i)
+    {
+        const long double a = baseline.countAtIndex(i), b = candidate.countAtIndex(i);
+        u += b * (baselineBelow + a / 2);
+        baselineBelow += a;
+        tieTerm += (a + b) * (a + b) * (a + b) - (a + b);
+    }
+    const long double variance = n1 * n2 / 12 * ((n + 1) - tieTerm / (n * (n - 1)));
+    z = variance <= 0 ? 0 : double((u - n1 * n2 / 2) / std::sqrt(variance));
+    return std::erfc(std::fabs(z) / std::sqrt(2.0));
+}
+
+// two-sample Kolmogorov-Smirnov on the bucket CDFs, return the asymptotic p value
+static double kolmogorovSmirnov(const HdrHistogram &baseline, const HdrHistogram &candidate, double &d)
+{
+    const double n1 = baseline.count(), n2 = candidate.count();
+    double cdf1 = 0, cdf2 = 0;
+    d = 0;
+    for (size_t i = 0; i < baseline.countsLength(); ++i)
+    {
+        cdf1 += baseline.countAtIndex(i) / n1;
+        cdf2 += candidate.countAtIndex(i) / n2;
+        d = std::max(d, std::fabs(cdf1 - cdf2));
+    }
+    const double effective = std::sqrt(n1 * n2 / (n1 + n2));
+    const double lambda = (effective + 0.12 + 0.11 / effective) * d;
+    // the series doesn't converge near 0, where Q(lambda) is 1 to many digits anyway
+    if (lambda < 0.2)
+    {
+        return 1;
+    }
+    double p = 0;
+    for (int k = 1; k <= 100; ++k)
+    {
+        const double term = 2 * (k % 2 == 1 ? 1 : -1) * std::exp(-2 * k * k * lambda * lambda);
+        p += term;
+        if (std::fabs(term) < 1e-12)
+        {
+            break;
+        }
+    }
+    return std::min(std::max(p, 0.0), 1.0);
+}
+
+// percentile of sorted values, 0 ~ 1
+static double percentileOf(const std::vector<double> &sorted, double quantile)
+{
+    return sorted.empty() ? 0 : sorted[size_t(quantile * (sorted.size() - 1) + 0.5)];
+}
+
+// print the comparison of one perf tool, return true if it regressed
+static bool compare(const std::string &name, HdrHistogram &baseline, HdrHistogram &candidate, const std::vector<double> &quantiles,
+                    const int resamples, const double alpha, const double regression, const int threads)
+{
+    printf("\n%s\nbaseline: %llu samples, mean %.1f ns\ncandidate: %llu samples, mean %.1f ns\n", name.c_str(),
+           (unsigned long long)baseline.count(), baseline.mean(), (unsigned long long)candidate.count(), candidate.mean());
+    if (baseline.count() < 2 || candidate.count() < 2)
+    {
+        printf("too few samples\n");
+        return false;
+    }
+    double z, d;
+    const double pMannWhitney = mannWhitney(baseline, candidate, z);
+    const double pKolmogorovSmirnov = kolmogorovSmirnov(baseline, candidate, d);
+    const bool bDifferent = pMannWhitney < alpha || pKolmogorovSmirnov < alpha;
+
+    const std::vector<double> changes = bootstrap(nonEmptyBuckets(baseline), nonEmptyBuckets(candidate), quantiles, resamples, threads);
+    printf("%10s %14s %14s %9s %21s\n", "percentile", "baseline(ns)", "candidate(ns)", "change", "confidence interval");
+    bool bRegression = false, bImprovement = false;
+    std::vector<double> sorted(resamples);
+    for (size_t q = 0; q < quantiles.size(); ++q)
+    {
+        for (int r = 0; r < resamples; ++r)
+        {
+            sorted[r] = changes[size_t(r) * quantiles.size() + q];
+        }
+        std::sort(sorted.begin(), sorted.end());
+        const double low = percentileOf(sorted, alpha / 2), high = percentileOf(sorted, 1 - alpha / 2);
+        const double baselineValue = baseline.valueAtQuantile(quantiles[q]), candidateValue = candidate.valueAtQuantile(quantiles[q]);
+        // the whole interval beyond the threshold, and the distributions differ
+        const bool bSlower = bDifferent && low * 100 > regression, bFaster = bDifferent && high * 100 < -regression;
+        bRegression = bRegression || bSlower;
+        bImprovement = bImprovement || bFaster;
+        printf("%9g%% %14.0f %14.0f %+8.2f%% [%+8.2f%%, %+8.2f%%] %s\n", quantiles[q] * 100, baselineValue, candidateValue,
+               baselineValue == 0 ? 0 : 100 * (candidateValue / baselineValue - 1), 100 * low, 100 * high,
+               bSlower ? "REGRESSION" : bFaster ? "improvement" : "");
+    }
+    printf("mann-whitney: z %+.2f, p %.3g\nkolmogorov-smirnov: D %.4f, p %.3g\n", z, pMannWhitney, d, pKolmogorovSmirnov);
+    printf("verdict: %s\n", bRegression ? "REGRESSION" : bImprovement ? "improvement" : "no significant regression");
+    return bRegression;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<double> quantiles = {0.5, 0.9, 0.99, 0.999};
+    int resamples = 1000, threads = std::max(1, int(std::thread::hardware_concurrency()));
+    double alpha = 0.01, regression = 5;
+    bool bFilterTag = false;
+    uint64_t tag = 0;
+    int option;
+    while ((option = getopt(argc, argv, "q:b:a:r:j:t:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'q':
+            if (!parseQuantiles(optarg, quantiles))
+            {
+                fprintf(stderr, "-q %s: expected comma separated percentiles from 0 to 100\n", optarg);
+                return 2;
+            }
+            std::sort(quantiles.begin(), quantiles.end());
+            break;
+        case 'b':
+        case 'a':
+        case 'r':
+        case 'j':
+        {
+            double value;
+            if (!parseNumber(optarg, value))
+            {
+                fprintf(stderr, "-%c %s: expected a number\n", option, optarg);
+                return 2;
+            }
+            if (option == 'b')
+            {
+                resamples = int(std::min(std::max(value, 10.0), 1e9));
+            }
+            else if (option == 'a')
+            {
+                alpha = std::min(std::max(value, 1e-9), 0.5);
+            }
+            else if (option == 'r')
+            {
+                regression = value;
+            }
+            else
+            {
+                threads = int(std::min(std::max(value, 1.0), 4096.0));
+            }
+            break;
+        }
+        case 't':
+        {
+            char *end;
+            bFilterTag = true;
+            tag = strtoull(optarg, &end, 0);
+            if (*optarg == '\0' || *end != '\0')
+            {
+                fprintf(stderr, "-t %s: expected an integer tag\n", optarg);
+                return 2;
+            }
+            break;
+        }
+        default:
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 2 || quantiles.empty())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::map<std::string, HdrHistogram> baselineRun, candidateRun;
+    if (!readRun(argv[optind], bFilterTag, tag, baselineRun) || !readRun(argv[optind + 1], bFilterTag, tag, candidateRun))
+    {
+        return 2;
+    }
+    printf("baseline: %s\ncandidate: %s\n%d resamples on %d threads, alpha %g, regression threshold %g%%\n",
+           argv[optind], argv[optind + 1], resamples, threads, alpha, regression);
+
+    bool bRegression = false;
+    std::vector<std::string> missing;
+    if (baselineRun.size() == 1 && candidateRun.size() == 1)
+    {
+        // two single runs, whatever their names
+        const std::string name = baselineRun.begin()->first == candidateRun.begin()->first
+                                     ? baselineRun.begin()->first
+                                     : baselineRun.begin()->first + " vs " + candidateRun.begin()->first;
+        bRegression = compare(name, baselineRun.begin()->second, candidateRun.begin()->second, quantiles, resamples, alpha, regression, threads);
+    }
+    else
+    {
+        for (auto &[name, baseline] : baselineRun)
+        {
+            auto candidate = candidateRun.find(name);
+            if (candidate == candidateRun.end())
+            {
+                printf("\n%s\nmissing in the candidate run\n", name.c_str());
+                missing.push_back(name + " (candidate)");
+                continue;
+            }
+            bRegression = compare(name, baseline, candidate->second, quantiles, resamples, alpha, regression, threads) || bRegression;
+        }
+        for (auto &[name, candidate] : candidateRun)
+        {
+            if (baselineRun.count(name) == 0)
+            {
+                printf("\n%s\nmissing in the baseline run\n", name.c_str());
+                missing.push_back(name + " (baseline)");
+            }
+        }
+    }
+    // a gate passing on timers it never compared would hide a renamed or lost timer
+    if (!missing.empty())
+    {
+        fprintf(stderr, "%zu timers missing in one run:", missing.size());
+        for (size_t i = 0; i < missing.size(); ++i)
+        {
+            fprintf(stderr, "%s %s", i == 0 ? "" : ",", missing[i].c_str());
+        }
+        fprintf(stderr, "\n");
+        return 2;
+    }
+    return bRegression ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+// perftool-dump: read a trace file written by PerfTool::startCapture()
+// g++ -O2 -o perftool-dump perfToolDump.cpp
+// perftool-dump [-i intervalMs] [-t tag] <trace file>
+#include "traceFile.hpp"
+#include "hdrHistogram.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static const double PERCENTILE_LIST[] = {25, 50, 75, 90, 95, 99, 99.9, 99.99};
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-i intervalMs] [-t tag] <trace file>\n"
+                    "  -i  length of a time series row in ms (default 1000, 0 disables the time series)\n"
+                    "  -t  only read records with this tag\n",
+            program);
+}
+
+// print the power-of-two buckets of the durations with a bar each
+static void printHistogram(const std::vector<uint64_t> &log2Counts, uint64_t total)
+{
+    printf("\nhistogram (ns)\n");
+    uint64_t largest = 0;
+    for (uint64_t count : log2Counts)
+    {
+        largest = std::max(largest, count);
+    }
+    for (size_t i = 0; i < log2Counts.size(); ++i)
+    {
+        if (log2Counts[i] == 0)
+        {
+            continue;
+        }
+        uint64_t low = i == 0 ? 0 : uint64_t(1) << (i - 1), high = (uint64_t(1) << i) - 1;
+        printf("%12llu ~ %-12llu %12llu %6.2f%% %s\n", (unsigned long long)low, (unsigned long long)high,
+               (unsigned long long)log2Counts[i], 100.0 * log2Counts[i] / total,
+               std::string(size_t(50.0 * log2Counts[i] / largest + 0.5), '#').c_str());
+    }
+}
+
+static void printTimeSeriesRow(double offsetSeconds, HdrHistogram &interval)
+{
+    printf("%10.3f %10llu %12lld %12lld %12lld %12lld\n", offsetSeconds, (unsigned long long)interval.count(),
+           (long long)interval.valueAtQuantile(0.5), (long long)interval.valueAtQuantile(0.99),
+           (long long)interval.valueAtQuantile(0.999), (long long)interval.max());
+}
+
+int main(int argc, char **argv)
+{
+    int64_t intervalMs = 1000;
+    bool bFilterTag = false;
+    uint64_t tag = 0;
+    int option;
+    while ((option = getopt(argc, argv, "i:t:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            intervalMs = atoll(optarg);
+            break;
+        case 't':
+            bFilterTag = true;
+            tag = strtoull(optarg, nullptr, 0);
+            break;
+        default:
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    TraceReader reader(argv[optind]);
+    if (!reader.isOpen())
+    {
+        fprintf(stderr, "%s: %s is not a readable trace file\n", argv[0], argv[optind]);
+        return 1;
+    }
+    const TraceHeader &info = reader.info();
+    printf("name: %s\npid: %d\nns per tick: %.6f\nrecords: %llu written, %llu kept (capacity %llu)\n",
+           info.name, info.pid, info.nsPerTick, (unsigned long long)info.writeIndex,
+           (unsigned long long)reader.size(), (unsigned long long)info.capacity);
+
+    // one pass over the file: whole run, log2 histogram and the time series rows
+    HdrHistogram total, interval;
+    std::vector<uint64_t> log2Counts(65, 0);
+    const int64_t intervalNs = intervalMs * 1000000;
+    int64_t firstNs = 0, intervalStart = 0;
+    bool bFirst = true;
+    if (intervalNs > 0)
+    {
+        printf("\ntime series (ns)\n%10s %10s %12s %12s %12s %12s\n", "offset(s)", "count", "50%", "99%", "99.9%", "max");
+    }
+    for (uint64_t i = 0; i < reader.size(); ++i)
+    {
+        const TraceRecord &record = reader.at(i);
+        if (bFilterTag && record.tag != tag)
+        {
+            continue;
+        }
+        const int64_t duration = int64_t(reader.toNs(record.durationTicks) + 0.5);
+        const int64_t startNs = reader.toRealtimeNs(record.startTick);
+        if (bFirst)
+        {
+            firstNs = intervalStart = startNs;
+            bFirst = false;
+        }
+        if (intervalNs > 0 && startNs >= intervalStart + intervalNs)
+        {
+            printTimeSeriesRow((intervalStart - firstNs) / 1e9, interval);
+            interval.reset();
+            intervalStart += (startNs - intervalStart) / intervalNs * intervalNs;
+        }
+        total.record(duration);
+        interval.record(duration);
+        // bucket i holds the durations of bit length i
+        ++log2Counts[duration <= 0 ? 0 : 64 - __builtin_clzll(uint64_t(duration))];
+    }
+    if (intervalNs > 0 && interval.count() != 0)
+    {
+        printTimeSeriesRow((intervalStart - firstNs) / 1e9, interval);
+    }
+    if (total.count() == 0)
+    {
+        printf("\nno records\n");
+        return 0;
+    }
+
+    printf("\nsummary (ns)\ncount: %llu\nmin: %lld\nmean: %.1f\nstd: %.1f\nmax: %lld\n",
+           (unsigned long long)total.count(), (long long)total.min(), total.mean(), total.stddev(),
+           (long long)total.max());
+    for (double percentile : PERCENTILE_LIST)
+    {
+        printf("%g%%: %lld\n", percentile, (long long)total.valueAtQuantile(percentile / 100));
+    }
+    printHistogram(log2Counts, total.count());
+    return 0;
+}
@@ -0,0 +1,479 @@
+#ifndef PERF_TOOL_POLICY_HEADER_GUARD
+#define PERF_TOOL_POLICY_HEADER_GUARD
+
+#include "tscClock.hpp"
+#include "hdrHistogram.hpp"
+#include "ddSketch.hpp"
+#include "epochWindow.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <variant>
+#include <algorithm>
+#include <type_traits>
+#include <time.h>
+
+// policies of BasicPerfTool<ClockPolicy, StatsPolicy>
+// both are picked at compile time, so reading the clock and recording a sample carry no
+// runtime switch; enabled == false turns every call into nothing, the object keeps its
+// fields though (sizeof(NoopPerfTool) is about 600 bytes, see the memory lines of the bench)
+// the optional features (sampling, probes, async reporting, tracing, top samples) are
+// runtime switches tested in begin() / end() / report(); the probes sit behind one pointer,
+// see IntervalProbes, and the switches cost less than the noise of the tsc/hdr bench
+
+// clock policies: where begin() and end() take their timestamps
+// begin(time) / end(time): raw 64-bit ticks, time is the value passed to
+// BasicPerfTool::begin() / end() (0 if none), in the same ticks as the clock
+// nsPerTick(): ticks are only converted to ns when a report is made
+
+// calibrated, fenced TSC (CLOCK_MONOTONIC_RAW ns without an invariant TSC)
+struct TscClockPolicy
+{
+    static constexpr bool enabled = true;
+
+    TscClockPolicy()
+    {
+        // calibrate at construction instead of inside the first begin()
+        TscClock::reliable();
+    }
+
+    uint64_t begin(uint64_t) { return TscClock::beginTicks(); }
+
+    uint64_t end(uint64_t) { return TscClock::endTicks(); }
+
+    double nsPerTick(void) const { return TscClock::ticksToNs(1); }
+};
+
+// clock_gettime(CLOCK_ID), ticks are ns
+template <clockid_t CLOCK_ID>
+struct PosixClockPolicy
+{
+    static constexpr bool enabled = true;
+
+    uint64_t begin(uint64_t) { return now(); }
+
+    uint64_t end(uint64_t) { return now(); }
+
+    double nsPerTick(void) const { return 1; }
+
+    static uint64_t now(void)
+    {
+        timespec time;
+        clock_gettime(CLOCK_ID, &time);
+        return uint64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+};
+
+using RealtimeClockPolicy = PosixClockPolicy<CLOCK_REALTIME>;
+using MonotonicClockPolicy = PosixClockPolicy<CLOCK_MONOTONIC>;
+// cpu time of the calling thread, time spent descheduled is not counted
+using ThreadCpuClockPolicy = PosixClockPolicy<CLOCK_THREAD_CPUTIME_ID>;
+
+// timestamps always come from the caller, in ns
+struct ExternalClockPolicy
+{
+    static constexpr bool enabled = true;
+
+    uint64_t begin(uint64_t time) { return time; }
+
+    uint64_t end(uint64_t time) { return time; }
+
+    double nsPerTick(void) const { return 1; }
+};
+
+// the clock of the runtime configured PerfTool
+// use the passed time if any, else the TSC when bUseCPUClock, else CLOCK_MONOTONIC
+// (CLOCK_REALTIME jumps and is slewed by NTP, intervals on it can even come out negative)
+class RuntimeClockPolicy
+{
+public:
+    static constexpr bool enabled = true;
+
+    explicit RuntimeClockPolicy(bool bUseCPUClock) : bUseCPUClock(bUseCPUClock)
+    {
+        if (bUseCPUClock)
+        {
+            TscClock::reliable();
+        }
+    }
+
+    uint64_t begin(uint64_t time)
+    {
+        if (time != 0)
+        {
+            return time;
+        }
+        return bUseCPUClock ? TscClock::beginTicks() : MonotonicClockPolicy::now();
+    }
+
+    uint64_t end(uint64_t time)
+    {
+        if (time != 0)
+        {
+            return time;
+        }
+        return bUseCPUClock ? TscClock::endTicks() : MonotonicClockPolicy::now();
+    }
+
+    double nsPerTick(void) const { return bUseCPUClock ? TscClock::ticksToNs(1) : 1; }
+
+private:
+    const bool bUseCPUClock;
+};
+
+struct NoopClockPolicy
+{
+    static constexpr bool enabled = false;
+
+    uint64_t begin(uint64_t) { return 0; }
+
+    uint64_t end(uint64_t) { return 0; }
+
+    double nsPerTick(void) const { return 1; }
+};
+
+// stats policies: what is kept of the recorded intervals, in clock ticks
+// record(value, endTime): add a sample, endTime moves time based windows
+// advance(): a report batch is complete
+// count() / mean() / stddev() / valueAtQuantile(q) describe the current window
+// windowBegin(): first tick of a time based window, 0 if the policy doesn't know
+
+// settings every stats policy is built from, each one takes what it needs
+struct StatsOptions
+{
+    // window length in samples and in closed epochs
+    int windowSize, epochs;
+    // 0 closes an epoch at every report batch, else every epochTime ticks
+    int64_t epochTime;
+    int significantDigits;
+    // in ticks
+    int64_t maxTrackableTime;
+    bool bUseSketch;
+};
+
+// count / sum / min / max only, no distribution
+// sums are kept in 128-bit integers, mean and std stay exact over any number of samples
+class MinMaxMean
+{
+public:
+    MinMaxMean() { reset(); }
+
+    void record(int64_t value, uint64_t count = 1)
+    {
+        totalCount += count;
+        totalSum += (unsigned __int128)value * count;
+        squareSum += (unsigned __int128)value * value * count;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+
+    void add(const MinMaxMean &other)
+    {
+        totalCount += other.totalCount;
+        totalSum += other.totalSum;
+        squareSum += other.squareSum;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    // min and max can't be taken back, EpochWindow keeps them per epoch
+    void subtract(const MinMaxMean &other)
+    {
+        totalCount -= other.totalCount;
+        totalSum -= other.totalSum;
+        squareSum -= other.squareSum;
+    }
+
+    void reset(void)
+    {
+        totalCount = 0;
+        totalSum = 0;
+        squareSum = 0;
+        minValue = INT64_MAX;
+        maxValue = 0;
+    }
+
+    uint64_t count(void) const { return totalCount; }
+
+    unsigned __int128 sum(void) const { return totalSum; }
+
+    int64_t min(void) const { return totalCount == 0 ? 0 : minValue; }
+
+    int64_t max(void) const { return maxValue; }
+
+    double mean(void) const { return totalCount == 0 ? 0 : (long double)totalSum / totalCount; }
+
+    double stddev(void) const
+    {
+        if (totalCount == 0)
+        {
+            return 0;
+        }
+        long double average = (long double)totalSum / totalCount;
+        return std::sqrt(std::max((long double)0, (long double)squareSum / totalCount - average * average));
+    }
+
+    // only the bounds are known, the mean stands in for everything between them
+    int64_t valueAtQuantile(double quantile) const
+    {
+        return quantile <= 0 ? min() : quantile >= 1 ? max()
+                                                     : int64_t(mean());
+    }
+
+private:
+    uint64_t totalCount;
+    unsigned __int128 totalSum, squareSum;
+    int64_t minValue, maxValue;
+};
+
+template <class Aggregate>
+Aggregate makeAggregate(const StatsOptions &options);
+
+template <>
+inline HdrHistogram makeAggregate<HdrHistogram>(const StatsOptions &options)
+{
+    return HdrHistogram(1, options.maxTrackableTime, options.significantDigits);
+}
+
+template <>
+inline DDSketch makeAggregate<DDSketch>(const StatsOptions &options)
+{
+    // 1 ~ 5 digits as HdrHistogram takes them
+    return DDSketch(std::pow(10, -std::min(std::max(options.significantDigits, 1), 5)), options.maxTrackableTime);
+}
+
+template <>
+inline MinMaxMean makeAggregate<MinMaxMean>(const StatsOptions &)
+{
+    return MinMaxMean();
+}
+
+// sliding window of epochs of Aggregate
+template <class Aggregate>
+class WindowStatsPolicy
+{
+public:
+    static constexpr bool enabled = true;
+    static constexpr bool hasQuantiles = !std::is_same<Aggregate, MinMaxMean>::value;
+
+    explicit WindowStatsPolicy(const StatsOptions &options)
+        : window(makeAggregate<Aggregate>(options), options.epochs, options.epochTime),
+          epochTime(options.epochTime)
+    {
+    }
+
+    void record(int64_t value, int64_t endTime)
+    {
+        if (epochTime != 0)
+        {
+            window.advanceTo(endTime);
+        }
+        window.record(value);
+    }
+
+    void advance(void)
+    {
+        if (epochTime == 0)
+        {
+            window.advance();
+        }
+    }
+
+    void reset(void) { window.reset(); }
+
+    uint64_t count(void) const { return window.count(); }
+
+    double mean(void) const { return window.mean(); }
+
+    double stddev(void) const { return window.stddev(); }
+
+    int64_t valueAtQuantile(double quantile) { return window.valueAtQuantile(quantile); }
+
+    int64_t windowBegin(void) const { return std::max<int64_t>(window.begin(), 0); }
+
+    EpochWindow<Aggregate> &epochWindow(void) { return window; }
+
+private:
+    EpochWindow<Aggregate> window;
+    const int64_t epochTime;
+};
+
+using HistogramStatsPolicy = WindowStatsPolicy<HdrHistogram>;
+using SketchStatsPolicy = WindowStatsPolicy<DDSketch>;
+using MinMaxMeanStatsPolicy = WindowStatsPolicy<MinMaxMean>;
+
+// keep every sample of the last windowSize ones, quantiles are exact
+class RawCaptureStatsPolicy
+{
+public:
+    static constexpr bool enabled = true;
+    static constexpr bool hasQuantiles = true;
+
+    explicit RawCaptureStatsPolicy(const StatsOptions &options)
+        : samples(std::max(options.windowSize, 1))
+    {
+        reset();
+    }
+
+    void record(int64_t value, int64_t)
+    {
+        samples[next] = value;
+        next = next + 1 == samples.size() ? 0 : next + 1;
+        filled = std::min(filled + 1, samples.size());
+        bSorted = false;
+    }
+
+    void advance(void) {}
+
+    void reset(void)
+    {
+        next = 0;
+        filled = 0;
+        bSorted = false;
+    }
+
+    uint64_t count(void) const { return filled; }
+
+    double mean(void) const
+    {
+        __int128 sum = 0;
+        for (size_t i = 0; i < filled; ++i)
+        {
+            sum += samples[i];
+        }
+        return filled == 0 ? 0 : (long double)sum / filled;
+    }
+
+    double stddev(void) const
+    {
+        double average = mean(), deviationSum = 0;
+        for (size_t i = 0; i < filled; ++i)
+        {
+            deviationSum += (samples[i] - average) * (samples[i] - average);
+        }
+        return filled == 0 ? 0 : std::sqrt(deviationSum / filled);
+    }
+
+    int64_t valueAtQuantile(double quantile)
+    {
+        if (filled == 0)
+        {
+            return 0;
+        }
+        if (!bSorted)
+        {
+            sorted.assign(samples.begin(), samples.begin() + filled);
+            std::sort(sorted.begin(), sorted.end());
+            bSorted = true;
+        }
+        quantile = std::min(std::max(quantile, 0.0), 1.0);
+        return sorted[size_t((filled - 1) * quantile)];
+    }
+
+    int64_t windowBegin(void) const { return 0; }
+
+private:
+    std::vector<int64_t> samples, sorted;
+    size_t next, filled;
+    bool bSorted;
+};
+
+// the statistics of the runtime configured PerfTool: histogram, or sketch when bUseSketch
+class RuntimeStatsPolicy
+{
+public:
+    static constexpr bool enabled = true;
+    static constexpr bool hasQuantiles = true;
+
+    explicit RuntimeStatsPolicy(const StatsOptions &options)
+        : stats(options.bUseSketch ? Stats(std::in_place_type<SketchStatsPolicy>, options)
+                                   : Stats(std::in_place_type<HistogramStatsPolicy>, options))
+    {
+    }
+
+    void record(int64_t value, int64_t endTime)
+    {
+        std::visit([value, endTime](auto &policy)
+                   { policy.record(value, endTime); },
+                   stats);
+    }
+
+    void advance(void)
+    {
+        std::visit([](auto &policy)
+                   { policy.advance(); },
+                   stats);
+    }
+
+    void reset(void)
+    {
+        std::visit([](auto &policy)
+                   { policy.reset(); },
+                   stats);
+    }
+
+    uint64_t count(void) const
+    {
+        return std::visit([](auto &policy)
+                          { return policy.count(); },
+                          stats);
+    }
+
+    double mean(void) const
+    {
+        return std::visit([](auto &policy)
+                          { return policy.mean(); },
+                          stats);
+    }
+
+    double stddev(void) const
+    {
+        return std::visit([](auto &policy)
+                          { return policy.stddev(); },
+                          stats);
+    }
+
+    int64_t valueAtQuantile(double quantile)
+    {
+        return std::visit([quantile](auto &policy)
+                          { return policy.valueAtQuantile(quantile); },
+                          stats);
+    }
+
+    int64_t windowBegin(void) const
+    {
+        return std::visit([](auto &policy)
+                          { return policy.windowBegin(); },
+                          stats);
+    }
+
+private:
+    using Stats = std::variant<HistogramStatsPolicy, SketchStatsPolicy>;
+    Stats stats;
+};
+
+struct NoopStatsPolicy
+{
+    static constexpr bool enabled = false;
+    static constexpr bool hasQuantiles = false;
+
+    explicit NoopStatsPolicy(const StatsOptions &) {}
+
+    void record(int64_t, int64_t) {}
+
+    void advance(void) {}
+
+    void reset(void) {}
+
+    uint64_t count(void) const { return 0; }
+
+    double mean(void) const { return 0; }
+
+    double stddev(void) const { return 0; }
+
+    int64_t valueAtQuantile(double) { return 0; }
+
+    int64_t windowBegin(void) const { return 0; }
+};
+
+#endif /* PERF_TOOL_POLICY_HEADER_GUARD */
@@ -0,0 +1,72 @@
+#ifndef SPSC_QUEUE_HEADER_GUARD
+#define SPSC_QUEUE_HEADER_GUARD
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// bounded lock-free single producer single consumer queue
+// push() is only called from one thread and pop() from one other thread,
+// both are wait-free and never allocate after construction
+template <class T>
+class SpscQueue
+{
+public:
+    // capacity: rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // return false if the queue is full
+    bool push(const T &value)
+    {
+        const size_t tail = writeIndex.load(std::memory_order_relaxed);
+        if (tail - cachedReadIndex > mask)
+        {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            if (tail - cachedReadIndex > mask)
+            {
+                return false;
+            }
+        }
+        slots[tail & mask] = value;
+        writeIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // return false if the queue is empty
+    bool pop(T &value)
+    {
+        const size_t head = readIndex.load(std::memory_order_relaxed);
+        if (head == cachedWriteIndex)
+        {
+            cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+            if (head == cachedWriteIndex)
+            {
+                return false;
+            }
+        }
+        value = slots[head & mask];
+        readIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // producer and consumer sides on their own cache lines
+    alignas(64) std::atomic<size_t> writeIndex{0};
+    size_t cachedReadIndex = 0;
+    alignas(64) std::atomic<size_t> readIndex{0};
+    size_t cachedWriteIndex = 0;
+};
+
+#endif /* SPSC_QUEUE_HEADER_GUARD */
@@ -1,7 +1,706 @@
 #include "perfTool.cpp"
+#include <thread>
+#include <malloc.h>
+
+// checks that failed, main() returns 1 if any did
+static int failedChecks = 0;
+
+static void check(const bool bPassed, const char *condition, const int line)
+{
+    if (!bPassed)
+    {
+        ++failedChecks;
+        std::fprintf(stderr, "test.cpp:%d: check failed: %s\n", line, condition);
+    }
+}
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+// log-uniform values from 1 to 10^9, the same on every run
+static std::vector<int64_t> logUniformValues(const size_t count)
+{
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> exponent(0, 9);
+    std::vector<int64_t> values(count);
+    for (int64_t &value : values)
+    {
+        value = int64_t(std::pow(10, exponent(random)));
+    }
+    return values;
+}
+
+// every quantile within 10^-significantDigits of the exact one (the same rank as the histogram)
+static void checkHistogramQuantiles(void)
+{
+    std::vector<int64_t> values = logUniformValues(100000);
+    for (int significantDigits : {1, 2, 3})
+    {
+        HdrHistogram histogram(1, 3600LL * 1000000000, significantDigits);
+        for (int64_t value : values)
+        {
+            histogram.record(value);
+        }
+        std::vector<int64_t> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        CHECK(histogram.count() == sorted.size());
+        CHECK(histogram.min() <= sorted.front() && histogram.max() >= sorted.back());
+        const double bound = std::pow(10, -significantDigits);
+        for (double quantile : {0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 0.9999})
+        {
+            const int64_t exact = sorted[std::max<size_t>(1, size_t(quantile * sorted.size() + 0.5)) - 1];
+            CHECK(std::abs(histogram.valueAtQuantile(quantile) - exact) <= exact * bound);
+        }
+    }
+}
+
+int fibonacci(PerfTool &perfTool, int n)
+{
+    PerfTool::Scope scope(perfTool);
+    return n < 2 ? n : fibonacci(perfTool, n - 1) + fibonacci(perfTool, n - 2);
+}
+
+// a request pipeline timed with the timer registry
+void handleRequest(int n)
+{
+    static const int requestTimer = TimerRegistry::instance().timer("request");
+    static const int parseTimer = TimerRegistry::instance().timer("parse");
+    static const int handleTimer = TimerRegistry::instance().timer("handle");
+    TimerScope requestScope(requestTimer);
+    {
+        TimerScope parseScope(parseTimer);
+        for (volatile int j = 0; j < 100; ++j)
+            ;
+    }
+    TimerScope handleScope(handleTimer);
+    for (volatile int j = 0; j < 100 * n; ++j)
+        ;
+}
+
+// quantiles within the relative accuracy (the same rank as the sketch), merges and serialized
+// copies equal to the sketch of all the values, out of range accuracies clamped
+static void checkSketch(void)
+{
+    std::vector<int64_t> values = logUniformValues(100000);
+    std::vector<int64_t> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    DDSketch all(0.01), first(0.01), second(0.01);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        all.record(values[i]);
+        (i % 2 == 0 ? first : second).record(values[i]);
+    }
+    std::stringstream stream;
+    second.serialize(stream);
+    DDSketch shipped(0.01);
+    CHECK(shipped.deserialize(stream));
+    first.add(shipped);
+    CHECK(first.count() == all.count() && first.sum() == all.sum());
+    CHECK(first.min() == all.min() && first.max() == all.max());
+    for (double quantile : {0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 0.9999})
+    {
+        const int64_t exact = sorted[size_t(quantile * (sorted.size() - 1))];
+        CHECK(std::abs(all.valueAtQuantile(quantile) - exact) <= exact * all.accuracy() + 1);
+        CHECK(first.valueAtQuantile(quantile) == all.valueAtQuantile(quantile));
+    }
+    std::stringstream other;
+    DDSketch(0.02).serialize(other);
+    CHECK(!shipped.deserialize(other));
+
+    // the buckets only span the keys seen, a merge or a subtraction grows them as needed
+    DDSketch narrow(0.01), wide(0.01);
+    narrow.record(1000);
+    narrow.record(10000);
+    wide.record(1);
+    wide.record(3600LL * 1000000000);
+    CHECK(narrow.memoryBytes() < 4096 && wide.memoryBytes() > 10000);
+    wide.add(narrow);
+    wide.subtract(narrow);
+    narrow.add(wide);
+    narrow.subtract(wide);
+    CHECK(narrow.count() == 2 && wide.count() == 2);
+    CHECK(std::abs(narrow.valueAtQuantile(0.5) - 1000) <= 1000 * narrow.accuracy() + 1);
+    CHECK(std::abs(wide.valueAtQuantile(1) - 3600LL * 1000000000) <= 3600LL * 1000000000 * wide.accuracy() + 1);
+
+    for (double accuracy : {0.0, -1.0, 2.0, std::nan("")})
+    {
+        DDSketch clamped(accuracy);
+        CHECK(clamped.accuracy() >= 1e-5 && clamped.accuracy() <= 0.5);
+        clamped.record(1000);
+        CHECK(std::abs(clamped.valueAtQuantile(0.5) - 1000) <= 1000 * clamped.accuracy() + 1);
+    }
+    for (int significantDigits : {0, -3, 9})
+    {
+        const StatsOptions options{1000, 1, 0, significantDigits, 3600LL * 1000000000, true};
+        DDSketch clamped = makeAggregate<DDSketch>(options);
+        CHECK(clamped.accuracy() >= 1e-5 && clamped.accuracy() <= 0.1);
+    }
+}
+
+// replayed timestamps land in the metric of their stage: queue waits, service times and end to end
+static void checkSpans(void)
+{
+    SpanPerfTool spans("the span check", {"accept", "parse", "execute"});
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        const uint64_t begin = 1000000 * (i + 1);
+        SpanPerfTool::Span span = spans.begin(begin);
+        spans.enqueue(span, begin + 100);
+        spans.hop(span, 1, begin + 300);
+        spans.hop(span, 2, begin + 700);
+        spans.end(span, begin + 1500 + i);
+    }
+    const std::vector<SpanPerfTool::Summary> summaries = spans.report();
+    // end to end, then wait and service of accept, parse and execute
+    CHECK(summaries.size() == 7);
+    const uint64_t counts[] = {100, 0, 100, 100, 100, 0, 100};
+    const double means[] = {1549.5, 0, 100, 200, 400, 0, 849.5};
+    for (size_t i = 0; i < summaries.size() && i < 7; ++i)
+    {
+        CHECK(summaries[i].count == counts[i]);
+        CHECK(std::abs(summaries[i].mean - means[i]) < 1e-9);
+    }
+    CHECK(summaries[0].name == "End to end" && summaries[6].name == "execute service");
+    CHECK(std::abs(summaries[6].p50 - 849) <= 849 * 0.01 + 1 && std::abs(summaries[6].max - 899) <= 899 * 0.01 + 1);
+    CHECK(std::abs(summaries[0].p99 - 1598) <= 1598 * 0.01 + 1);
+    CHECK(spans.report()[0].count == 0);
+}
+
+// report(os, topN) lists the keys with the highest p99 first, quantiles hold the 3.2% bound
+static void checkLabeled(void)
+{
+    LabeledPerfTool labeled;
+    const uint64_t uniform = LabeledPerfTool::key(LabeledPerfTool::label("check/uniform")),
+                   slow = LabeledPerfTool::key(LabeledPerfTool::label("check/slow")),
+                   fast = LabeledPerfTool::key(LabeledPerfTool::label("check/fast"));
+    for (uint64_t ticks = 1; ticks <= 1000; ++ticks)
+    {
+        labeled.record(uniform, ticks);
+        labeled.record(fast, 100);
+        labeled.record(slow, 10000);
+    }
+    std::ostringstream top;
+    labeled.report(top, 2);
+    std::istringstream lines(top.str());
+    std::string header, first, second, third;
+    std::getline(lines, header);
+    std::getline(lines, first);
+    std::getline(lines, second);
+    CHECK(first.compare(0, 11, "check/slow ") == 0 && second.compare(0, 14, "check/uniform ") == 0);
+    CHECK(!std::getline(lines, third));
+
+    for (const LabeledPerfTool::Summary &summary : labeled.summaries())
+    {
+        if (summary.label == "check/uniform")
+        {
+            CHECK(summary.count == 1000);
+            CHECK(std::abs(summary.p50 - TscClock::ticksToNs(500)) <= TscClock::ticksToNs(500) * 0.032 + TscClock::ticksToNs(1));
+            CHECK(std::abs(summary.p99 - TscClock::ticksToNs(990)) <= TscClock::ticksToNs(990) * 0.032 + TscClock::ticksToNs(1));
+        }
+        else if (summary.label == "check/slow")
+        {
+            CHECK(summary.p99 == TscClock::ticksToNs(10000) && summary.min == summary.max);
+        }
+    }
+}
+
+// every exported record, for the checks
+class RecordingExporter : public Exporter
+{
+public:
+    struct Record
+    {
+        std::string name;
+        int64_t windowBegin, windowEnd;
+        uint64_t count;
+        double mean, min, max;
+    };
+
+    std::vector<Record> records;
+
+    RecordingExporter() : Exporter({0.5}, SIZE_MAX, std::chrono::hours(1)) {}
+
+protected:
+    void format(const ExportRecord &record) override
+    {
+        records.push_back({std::string(record.name), record.windowBegin, record.windowEnd, record.count, record.mean,
+                           record.min, record.max});
+    }
+};
+
+// a time based window answers from its open epoch and spans epochs to epochs + 1 epochTime
+static void checkTimeWindow(void)
+{
+    EpochWindow<HdrHistogram> window(HdrHistogram(1, 1000000, 2), 3, 100);
+    window.advanceTo(1000);
+    window.record(5);
+    CHECK(window.count() == 1 && window.min() == 5 && window.max() == 5 && window.valueAtQuantile(0.5) == 5);
+    CHECK(window.begin() == 1000);
+    window.advanceTo(1150);
+    window.record(7);
+    CHECK(window.count() == 2 && window.max() == 7 && window.begin() == 1000);
+    // three more epochs close, the one holding 5 drops out
+    window.advanceTo(1450);
+    CHECK(window.count() == 1 && window.min() == 7 && window.begin() == 1100);
+
+    // 10 epochs of 1s, reported long before the first one closes
+    RecordingExporter exporter;
+    PerfTool timeTest("the time window test", 10, 10, 100, true, 0, false, 2, 3600LL * 1000000000, false, 1000000000LL);
+    timeTest.setExporter(&exporter);
+    const int64_t before = RealtimeClockPolicy::now();
+    for (int i = 0; i < 10; ++i)
+    {
+        timeTest.begin();
+        timeTest.end();
+        timeTest.report();
+    }
+    CHECK(exporter.records.size() == 1);
+    if (!exporter.records.empty())
+    {
+        const RecordingExporter::Record &record = exporter.records.back();
+        CHECK(record.count == 10);
+        CHECK(record.windowBegin <= before + 1000000 && record.windowBegin > before - 1000000000LL - 1000000);
+        CHECK(record.windowEnd >= before && record.windowEnd <= int64_t(RealtimeClockPolicy::now()));
+    }
+}
+
+// more threads than shards at once, then threads coming and going: no count is lost and no
+// interval is made of two threads' timestamps
+static void checkConcurrentShards(void)
+{
+    RecordingExporter exporter;
+    ConcurrentPerfTool overflowTest("the shard overflow test", 2);
+    overflowTest.setExporter(&exporter);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&overflowTest]()
+                             {
+                                 for (int i = 0; i < 1000; ++i)
+                                 {
+                                     overflowTest.begin();
+                                     overflowTest.end();
+                                     if (i % 100 == 0)
+                                     {
+                                         std::this_thread::yield();
+                                     }
+                                 } });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    threads.clear();
+    for (int t = 0; t < 10; ++t)
+    {
+        std::thread([&overflowTest]()
+                    {
+                        for (int i = 0; i < 100; ++i)
+                        {
+                            overflowTest.record(1000);
+                        } })
+            .join();
+    }
+    overflowTest.report();
+    CHECK(exporter.records.size() == 1);
+    if (!exporter.records.empty())
+    {
+        CHECK(exporter.records[0].count == 9000);
+        CHECK(exporter.records[0].max < 1e9);
+    }
+}
+
+// an interval of 10 expected intervals back-fills the 9 requests stalled behind it:
+// 9 intervals, 8 intervals ... down to 2 expected intervals
+static void checkCorrected(void)
+{
+    BasicPerfTool<ExternalClockPolicy, HistogramStatsPolicy> correctedCheck("the corrected check", 1000, 1000);
+    correctedCheck.setExpectedInterval(100);
+    uint64_t time = 1000;
+    for (int i = 0; i < 10; ++i)
+    {
+        correctedCheck.begin(time);
+        time += i == 9 ? 1000 : 100;
+        correctedCheck.end(time);
+        correctedCheck.report();
+    }
+    CHECK(correctedCheck.correctedCount() == 19);
+    CHECK(correctedCheck.correctedQuantile(1) == 1000);
+    CHECK(correctedCheck.correctedQuantile(0) == 100);
+    // 9 measured and 1 back-filled intervals of 100, then 200 ... 1000
+    CHECK(correctedCheck.correctedQuantile(0.5) == 100 && correctedCheck.correctedQuantile(0.6) == 200);
+    CHECK(correctedCheck.quantile(0.9) == 100 && correctedCheck.quantile(1) == 1000);
+}
+
+// external times when passed, its own reads (time 0) 25 ticks apart: an empty pair costs 25
+struct SteppingClockPolicy
+{
+    static constexpr bool enabled = true;
+    uint64_t ticks = 0;
+
+    uint64_t begin(uint64_t time) { return time != 0 ? time : ticks += 25; }
+
+    uint64_t end(uint64_t time) { return time != 0 ? time : ticks += 25; }
+
+    double nsPerTick(void) const { return 1; }
+};
+
+// the calibrated cost of a clock pair comes off every interval, shorter ones record 0
+static void checkOverhead(void)
+{
+    BasicPerfTool<SteppingClockPolicy, HistogramStatsPolicy> overheadCheck("the overhead check", 1000, 1000);
+    CHECK(overheadCheck.calibrateOverhead(100) == 25);
+    const uint64_t lengths[] = {100, 60, 25, 10};
+    uint64_t time = 1000;
+    for (const uint64_t length : lengths)
+    {
+        overheadCheck.begin(time);
+        overheadCheck.end(time + length);
+        overheadCheck.report();
+        time += 1000;
+    }
+    CHECK(overheadCheck.quantile(1) == 75 && overheadCheck.quantile(0.5) == 0 && overheadCheck.quantile(0) == 0);
+    CHECK(overheadCheck.quantile(0.75) == 35);
+}
+
+// rates over the window of a full report: 10 calls of 500 ticks with 250 units of work each,
+// 1000 ticks apart, span 9500 ns; the next window without work reports no work rates
+static void checkThroughput(void)
+{
+    BasicPerfTool<ExternalClockPolicy, HistogramStatsPolicy> throughputCheck("the throughput check", 10, 10);
+    for (uint64_t i = 0; i < 20; ++i)
+    {
+        const uint64_t begin = 1000 * (i + 1);
+        throughputCheck.begin(begin);
+        if (i < 10)
+        {
+            throughputCheck.end(decltype(throughputCheck)::Work{250}, begin + 500);
+        }
+        else
+        {
+            throughputCheck.end(begin + 500);
+        }
+        throughputCheck.report();
+        if (i == 9)
+        {
+            const auto rates = throughputCheck.throughput();
+            CHECK(std::abs(rates.callsPerSecond - 10 / 9500e-9) < 1e-3);
+            CHECK(std::abs(rates.workPerSecond - 2500 / 9500e-9) < 1e-1);
+            CHECK(rates.workPerCall == 250);
+            CHECK(std::abs(rates.nsPerUnit - 2) <= 2 * 0.01);
+        }
+    }
+    const auto rates = throughputCheck.throughput();
+    CHECK(std::abs(rates.callsPerSecond - 10 / 9500e-9) < 1e-3);
+    CHECK(rates.workPerSecond == 0 && rates.workPerCall == 0 && rates.nsPerUnit == 0);
+}
+
+// tokens on one instance time their own intervals, nested or overlapping: the clock steps 25
+// per read, so outer spans 25 ~ 125, inner 50 ~ 75 and overlapping 100 ~ 150
+static void checkTokens(void)
+{
+    using TokenCheck = BasicPerfTool<SteppingClockPolicy, HistogramStatsPolicy>;
+    TokenCheck tokenCheck("the token check", 1000, 1000);
+    // room for one more than the intervals, so the size is their count
+    tokenCheck.enableTopSamples(4);
+    const TokenCheck::Token outer = tokenCheck.begin();
+    const TokenCheck::Token inner = tokenCheck.begin();
+    tokenCheck.end(inner, 2);
+    const TokenCheck::Token overlapping = tokenCheck.begin();
+    tokenCheck.end(outer, 1);
+    tokenCheck.end(overlapping, 3);
+    const std::vector<std::pair<double, uint64_t>> slowest = tokenCheck.slowestSamples();
+    CHECK(slowest.size() == 3);
+    if (slowest.size() == 3)
+    {
+        CHECK(slowest[0] == std::make_pair(100.0, uint64_t(1)));
+        CHECK(slowest[1] == std::make_pair(50.0, uint64_t(3)));
+        CHECK(slowest[2] == std::make_pair(25.0, uint64_t(2)));
+    }
+    CHECK(tokenCheck.quantile(0) == 25 && tokenCheck.quantile(0.5) == 50 && tokenCheck.quantile(1) == 100);
+}
+
+// the reporter thread reports the same windows as the inline path: same samples on external
+// ticks, batches smaller than the report windows but enough of them that none is dropped,
+// compared after stopReporter()
+static void checkAsyncReporter(void)
+{
+    using AsyncCheck = BasicPerfTool<ExternalClockPolicy, HistogramStatsPolicy>;
+    RecordingExporter syncRecords, asyncRecords;
+    AsyncCheck syncCheck("the sync check", 100, 30), asyncCheck("the async check", 100, 30);
+    syncCheck.setExporter(&syncRecords);
+    asyncCheck.setExporter(&asyncRecords);
+    asyncCheck.startReporter(64, 16);
+    uint64_t time = 1000;
+    for (uint64_t i = 0; i < 250; ++i)
+    {
+        const uint64_t length = 100 + i * 37 % 300;
+        for (AsyncCheck *check : {&syncCheck, &asyncCheck})
+        {
+            check->begin(time);
+            check->end(time + length);
+            check->report();
+        }
+        time += 1000;
+    }
+    asyncCheck.stopReporter();
+    CHECK(syncRecords.records.size() == 2 && asyncRecords.records.size() == syncRecords.records.size());
+    for (size_t i = 0; i < syncRecords.records.size() && i < asyncRecords.records.size(); ++i)
+    {
+        const RecordingExporter::Record &expected = syncRecords.records[i], &actual = asyncRecords.records[i];
+        CHECK(actual.count == expected.count && actual.mean == expected.mean);
+        CHECK(actual.min == expected.min && actual.max == expected.max);
+    }
+    for (double quantile : {0.0, 0.5, 0.9, 0.99, 1.0})
+    {
+        CHECK(asyncCheck.quantile(quantile) == syncCheck.quantile(quantile));
+    }
+}
+
+// the 3 slowest samples with their contexts, kept until the next full report
+static void checkTopSamples(void)
+{
+    using TopCheck = BasicPerfTool<ExternalClockPolicy, HistogramStatsPolicy>;
+    RecordingExporter exporter;
+    TopCheck topCheck("the top samples check", 50, 1000);
+    topCheck.enableTopSamples(3);
+    uint64_t time = 1000;
+    // 100 + 7 * i mod 300: 49 distinct durations, the longest 394, 387, 380 at i = 42, 41, 40
+    for (int i = 0; i < 49; ++i)
+    {
+        topCheck.begin(time);
+        time += 100 + (7 * i) % 300;
+        topCheck.end(TopCheck::Context{uint64_t(i)}, time);
+        topCheck.report();
+    }
+    const std::vector<std::pair<double, uint64_t>> slowest = topCheck.slowestSamples();
+    CHECK(slowest.size() == 3);
+    if (slowest.size() == 3)
+    {
+        CHECK(slowest[0].first == 394 && slowest[0].second == 42);
+        CHECK(slowest[1].first == 387 && slowest[1].second == 41);
+        CHECK(slowest[2].first == 380 && slowest[2].second == 40);
+    }
+    // the 50th sample completes the report, which logs the list and starts a new one
+    topCheck.begin(time);
+    topCheck.end(TopCheck::Context{49}, time + 100);
+    topCheck.report();
+    CHECK(topCheck.slowestSamples().empty());
+
+    // analysisReport() logs nothing but the list starts over at its full reports all the same:
+    // shorter and shorter samples, only 50 to 59 are left after the report at the 50th
+    topCheck.setExporter(&exporter);
+    for (int i = 0; i < 60; ++i)
+    {
+        topCheck.begin(time);
+        time += 2000 - i;
+        topCheck.end(TopCheck::Context{uint64_t(i)}, time);
+        topCheck.analysisReport();
+    }
+    const std::vector<std::pair<double, uint64_t>> analysisSlowest = topCheck.slowestSamples();
+    CHECK(exporter.records.size() == 1);
+    CHECK(analysisSlowest.size() == 3 && analysisSlowest[0].second == 50);
+}
+
+// every sample stands for the calls since the previous one: the weights add up to the calls, the
+// exported count is scaled back to them, and a forced report on an unsampled call still reports
+static void checkSampling(void)
+{
+    using SamplingCheck = BasicPerfTool<ExternalClockPolicy, HistogramStatsPolicy>;
+    RecordingExporter exporter;
+    SamplingCheck samplingCheck("the sampling check", 1000000, 1000000);
+    samplingCheck.setExporter(&exporter);
+    samplingCheck.setSampling(8);
+    uint64_t time = 1000, calls = 0, samples = 0, weights = 0, sampledCalls = 0;
+    while (true)
+    {
+        const SamplingCheck::Token token = samplingCheck.begin(time);
+        samplingCheck.end(time + 100);
+        time += 200;
+        ++calls;
+        if (token.time == 0 && calls > 10000)
+        {
+            samplingCheck.report(true);
+            break;
+        }
+        samplingCheck.report();
+        if (token.time != 0)
+        {
+            ++samples;
+            weights += token.weight;
+            sampledCalls = calls;
+        }
+    }
+    CHECK(weights == sampledCalls);
+    CHECK(samples > calls / 16 && samples < calls / 4);
+    CHECK(exporter.records.size() == 1);
+    if (!exporter.records.empty())
+    {
+        CHECK(exporter.records[0].count == sampledCalls);
+    }
+    // back to every call, each one its own sample
+    samplingCheck.setSampling(1);
+    const SamplingCheck::Token token = samplingCheck.begin(time);
+    CHECK(token.time == time && token.weight == 1);
+
+    // analysisReport() scales the exported count back the same way, 100 samples of about 8 calls
+    RecordingExporter analysisExporter;
+    SamplingCheck analysisCheck("the sampling analysis check", 100, 1000000);
+    analysisCheck.setExporter(&analysisExporter);
+    analysisCheck.setSampling(8);
+    for (int i = 0; i < 8000; ++i)
+    {
+        analysisCheck.begin(time);
+        analysisCheck.end(time + 100);
+        time += 200;
+        analysisCheck.analysisReport();
+    }
+    CHECK(analysisExporter.records.size() >= 8);
+    for (const RecordingExporter::Record &record : analysisExporter.records)
+    {
+        CHECK(record.count > 600 && record.count < 1000);
+    }
+}
+
+// every allocation entry point is counted once and the frees of its blocks balance it,
+// counts and usable bytes alike; the blocks go through volatile so no pair is optimized out
+// skipped in builds without allocHooks.cpp, nothing counts there
+static void checkAllocationCounts(void)
+{
+    if (!allocHooksLinked.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    const AllocCounters before = threadAllocCounters;
+    void *volatile blocks[9];
+    blocks[0] = malloc(100);
+    blocks[1] = calloc(10, 10);
+    blocks[2] = valloc(100);
+    blocks[3] = pvalloc(100);
+    blocks[4] = memalign(64, 100);
+    blocks[5] = aligned_alloc(64, 128);
+    void *aligned = nullptr;
+    CHECK(posix_memalign(&aligned, 64, 100) == 0);
+    blocks[6] = aligned;
+    blocks[7] = reallocarray(nullptr, 10, 10);
+    blocks[8] = new char[100];
+    const AllocCounters allocated = threadAllocCounters;
+    CHECK(allocated.allocations - before.allocations == 9);
+    CHECK(allocated.frees == before.frees);
+    CHECK(allocated.allocatedBytes - before.allocatedBytes >= 9 * 100);
+
+    // a grown block either moves (a free and an allocation) or stays, the balance holds
+    blocks[7] = reallocarray(blocks[7], 1000, 100);
+    blocks[0] = realloc(blocks[0], 100000);
+    // an overflowing product fails without a count, volatile keeps the compiler from seeing it
+    const volatile size_t huge = SIZE_MAX / 2;
+    errno = 0;
+    CHECK(reallocarray(nullptr, huge, 3) == nullptr && errno == ENOMEM);
+    const AllocCounters grown = threadAllocCounters;
+    CHECK(grown.allocations - grown.frees == allocated.allocations - allocated.frees);
+
+    delete[] static_cast<char *>(blocks[8]);
+    for (int i = 0; i < 8; ++i)
+    {
+        free(blocks[i]);
+    }
+    const AllocCounters after = threadAllocCounters;
+    CHECK(after.allocations - before.allocations == after.frees - before.frees);
+    CHECK(after.allocatedBytes - before.allocatedBytes == after.freedBytes - before.freedBytes);
+}
+
+// the Prometheus file holds gauges of the last report only, stddev included
+static void checkPrometheus(void)
+{
+    {
+        PrometheusExporter exporter("the prometheus test.prom", {0.5});
+        const double quantileValues[] = {40};
+        exporter.write({"a", 0, 0, 1000000000, 100, 50, 20, 5, 400, 0, quantileValues});
+        exporter.write({"a", 0, 0, 1000000000, 30, 45, 10, 6, 300, 0, quantileValues});
+    }
+    std::ifstream file("the prometheus test.prom");
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK(text.find("summary") == std::string::npos);
+    CHECK(text.find("perftool_duration_ns{name=\"a\",quantile=\"0.5\"} 40\n") != std::string::npos);
+    CHECK(text.find("perftool_window_count{name=\"a\"} 30\n") != std::string::npos);
+    CHECK(text.find("perftool_duration_mean_ns{name=\"a\"} 45.0\n") != std::string::npos);
+    CHECK(text.find("perftool_duration_stddev_ns{name=\"a\"} 10.0\n") != std::string::npos);
+    CHECK(text.find("perftool_duration_max_ns{name=\"a\"} 300.0\n") != std::string::npos);
+    std::remove("the prometheus test.prom");
+}
+
+// every event a thread kept reaches the file after the thread exited, the rest are counted
+// as dropped, and the buffers of the exited threads are freed once drained
+static void checkChromeTrace(void)
+{
+    ChromeTracer &tracer = ChromeTracer::instance();
+    const size_t buffersBefore = tracer.threadBuffers();
+    // no drain before stop(), the 64 events buffer of a thread fills up
+    CHECK(tracer.start("the chrome trace test.json", std::chrono::milliseconds(0), 64, std::chrono::hours(1), false));
+    const uint32_t nameId = tracer.name("the chrome trace test");
+    const int64_t begin = int64_t(RealtimeClockPolicy::now());
+    std::vector<std::thread> threads;
+    for (const int events : {100, 10, 64})
+    {
+        threads.emplace_back([&tracer, nameId, begin, events]()
+                             {
+                                 for (int i = 0; i < events; ++i)
+                                 {
+                                     tracer.record(nameId, begin + 1000 * i, 10);
+                                 } });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(tracer.threadBuffers() == buffersBefore + 3);
+    CHECK(tracer.dropped() == 36);
+    tracer.stop();
+    CHECK(tracer.threadBuffers() == buffersBefore);
+
+    std::ifstream file("the chrome trace test.json");
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::string event = "{\"name\":\"the chrome trace test\",\"cat\":\"perftool\",\"ph\":\"X\"";
+    int events = 0;
+    for (size_t at = text.find(event); at != std::string::npos; at = text.find(event, at + 1))
+    {
+        ++events;
+    }
+    CHECK(events == 64 + 10 + 64);
+    CHECK(text.find("\"dropped_events\":\"36\"") != std::string::npos);
+    CHECK(text.compare(text.size() - 3, 3, "}}\n") == 0);
+    std::remove("the chrome trace test.json");
+}
+
 int main(void)
 {
+    checkHistogramQuantiles();
+    checkSketch();
+    checkTimeWindow();
+    checkConcurrentShards();
+    checkPrometheus();
+    checkCorrected();
+    checkTopSamples();
+    checkSampling();
+    checkAllocationCounts();
+    checkChromeTrace();
+    checkSpans();
+    checkLabeled();
+    checkThroughput();
+    checkOverhead();
+    checkAsyncReporter();
+    checkTokens();
+
+    // declared first, exporters must outlive the perf tools writing to them
+    JsonLinesExporter jsonExporter("reports.jsonl");
+    CsvExporter csvExporter("reports.csv", {0.5, 0.99});
+    PrometheusExporter prometheusExporter("perftool.prom");
+
+    // timeline of the tests, open it in ui.perfetto.dev
+    ChromeTracer::instance().start("perftool.trace.json");
+
     PerfTool reportTest = PerfTool("the report test", 30, 10, 90, true, 1, false);
+    reportTest.setExporter(&jsonExporter);
+    reportTest.enableChromeTrace();
         PerfTool slaveTest = PerfTool("the slave test", &reportTest);
     for (int i = 0; i < 180; ++i)
     {
@@ -19,6 +718,8 @@ int main(void)
 
 
     PerfTool CPUCLOCKTest = PerfTool("the cpu clock test",  30, 10 , 80, true, 0, true);
+    CPUCLOCKTest.setExporter(&csvExporter);
+    CPUCLOCKTest.calibrateOverhead();
         for (int i = 0; i < 180; ++i)
     {
         CPUCLOCKTest.begin();
@@ -28,7 +729,263 @@ int main(void)
         CPUCLOCKTest.report();
     }
     CPUCLOCKTest.report(true);
+
+    PerfTool sketchTest = PerfTool("the sketch test", 30, 10, 90, true, 0, false, 2, 3600LL * 1000000000, true);
+    sketchTest.enableCounters();
+    for (int i = 0; i < 180; ++i)
+    {
+        sketchTest.begin();
+        for (int j = 0; j < 1000; ++j)
+         ;
+        sketchTest.end();
+        sketchTest.report();
+    }
+    sketchTest.report(true);
+    sketchTest.analysisReport(true);
+
+    PerfTool cpuSplitTest = PerfTool("the cpu split test", 30, 10, 90, true, 0, false);
+    cpuSplitTest.enableCpuSplit();
+    for (int i = 0; i < 90; ++i)
+    {
+        cpuSplitTest.begin();
+        for (volatile int j = 0; j < 1000; ++j)
+            ;
+        if (i % 10 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        cpuSplitTest.end();
+        cpuSplitTest.report();
+    }
+
+    // a request every 50us, one in 30 stalls for 2ms
+    PerfTool correctedTest = PerfTool("the corrected test", 30, 10, 90, true, 0, false);
+    correctedTest.setExpectedInterval(50000);
+    for (int i = 0; i < 90; ++i)
+    {
+        correctedTest.begin();
+        std::this_thread::sleep_for(std::chrono::microseconds(i % 30 == 29 ? 2000 : 10));
+        correctedTest.end();
+        correctedTest.report();
+    }
+
+    PerfTool topTest = PerfTool("the top samples test", 30, 10, 90, true, 0, false);
+    topTest.enableChromeTrace();
+    topTest.enableTopSamples(3);
+    for (int i = 0; i < 90; ++i)
+    {
+        topTest.begin();
+        for (volatile int j = 0; j < (i % 7 == 0 ? 100000 : 1000); ++j)
+            ;
+        topTest.end(PerfTool::Context{uint64_t(1000 + i)});
+        topTest.report();
+    }
+
+    PerfTool throughputTest = PerfTool("the throughput test", 30, 10, 90, true, 0, false);
+    std::vector<char> payload(64 * 1024);
+    for (int i = 0; i < 90; ++i)
+    {
+        const size_t bytes = 1024 * (1 + i % 64);
+        throughputTest.begin();
+        std::fill(payload.begin(), payload.begin() + bytes, char(i));
+        throughputTest.end(PerfTool::Work{bytes});
+        throughputTest.report();
+    }
+
+    PerfTool allocationTest = PerfTool("the allocation test", 30, 10, 90, true, 0, false);
+    if (allocationTest.enableAllocations())
+    {
+        for (int i = 0; i < 90; ++i)
+        {
+            allocationTest.begin();
+            std::vector<std::string> strings;
+            for (int j = 0; j < i % 4; ++j)
+            {
+                strings.push_back(std::string(64 * (j + 1), 'a'));
+            }
+            allocationTest.end();
+            allocationTest.report();
+        }
+    }
+
+    PerfTool samplingTest = PerfTool("the sampling test", 30, 10, 90, true, 0, false);
+    samplingTest.setSampling(10);
+    for (int i = 0; i < 900; ++i)
+    {
+        samplingTest.begin();
+        std::fill(payload.begin(), payload.begin() + 4096, char(i));
+        samplingTest.end(PerfTool::Work{4096});
+        samplingTest.report();
+    }
+
+    PerfTool adaptiveTest = PerfTool("the adaptive sampling test", 30, 10, 90, true, 0, false);
+    adaptiveTest.setAdaptiveSampling(1000, 0.01);
+    for (int i = 0; i < 300000; ++i)
+    {
+        PerfTool::Token token = adaptiveTest.begin();
+        std::fill(payload.begin(), payload.begin() + 256, char(i));
+        adaptiveTest.end(token);
+    }
+
+    PerfTool tokenTest = PerfTool("the token test", 30, 10, 90, true, 0, false);
+    tokenTest.startCapture("the token test.trace", 4096);
+    for (int i = 0; i < 180; ++i)
+    {
+        PerfTool::Token outer = tokenTest.begin();
+        PerfTool::Token inner = tokenTest.begin();
+        tokenTest.end(inner, 1);
+        tokenTest.end(outer);
+    }
+    fibonacci(tokenTest, 10);
+    tokenTest.report(true);
+
+    BasicPerfTool<TscClockPolicy, MinMaxMeanStatsPolicy> policyTest("the policy test", 30, 10, 90, true, 0);
+    BasicPerfTool<MonotonicClockPolicy, RawCaptureStatsPolicy> rawTest("the raw capture test", 30, 10, 90, true, 0);
+    NoopPerfTool noopTest("the noop test", 30, 10);
+    for (int i = 0; i < 180; ++i)
+    {
+        BasicPerfTool<TscClockPolicy, MinMaxMeanStatsPolicy>::Scope policyScope(policyTest);
+        BasicPerfTool<MonotonicClockPolicy, RawCaptureStatsPolicy>::Scope rawScope(rawTest);
+        NoopPerfTool::Scope noopScope(noopTest);
+        for (int j = 0; j < 1000; ++j)
+         ;
+    }
+    policyTest.report(true);
+    rawTest.report(true);
+
+    ConcurrentPerfTool concurrentTest("the concurrent test", 4);
+    concurrentTest.setExporter(&prometheusExporter);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t)
+    {
+        workers.emplace_back([&concurrentTest]()
+                             {
+                                 for (int i = 0; i < 180; ++i)
+                                 {
+                                     concurrentTest.begin();
+                                     for (int j = 0; j < 1000; ++j)
+                                         ;
+                                     concurrentTest.end();
+                                 } });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    concurrentTest.report();
+
+    PerfTool asyncTest = PerfTool("the async test", 30, 10, 90, true, 0, true);
+    asyncTest.enableChromeTrace();
+    asyncTest.startReporter(32);
+    for (int i = 0; i < 180; ++i)
+    {
+        asyncTest.begin();
+        for (int j = 0; j < 1000; ++j)
+            ;
+        asyncTest.end();
+        asyncTest.report();
+    }
+    asyncTest.stopReporter();
     
-    // 
+    // two runs for perftool-compare, the candidate does twice the work
+    PerfTool compareBaseline("the compare baseline", 1000, 1000, 1000, true, 0, false);
+    PerfTool compareCandidate("the compare candidate", 1000, 1000, 1000, true, 0, false);
+    compareBaseline.startCapture("the compare baseline.trace", 4096);
+    compareCandidate.startCapture("the compare candidate.trace", 4096);
+    for (int i = 0; i < 2000; ++i)
+    {
+        PerfTool &tool = i % 2 == 0 ? compareBaseline : compareCandidate;
+        tool.begin();
+        for (volatile int j = 0; j < (i % 2 == 0 ? 1000 : 2000); ++j)
+            ;
+        tool.end();
+        tool.report();
+    }
+
+    // accepted on this thread, queued, parsed and executed on a worker
+    SpanPerfTool spanTest("the span test", {"accept", "parse", "execute"});
+    SpscQueue<SpanPerfTool::Span> requests(64);
+    std::thread worker([&spanTest, &requests]()
+                       {
+                           for (int done = 0; done < 180;)
+                           {
+                               SpanPerfTool::Span span;
+                               if (!requests.pop(span))
+                               {
+                                   std::this_thread::yield();
+                                   continue;
+                               }
+                               spanTest.hop(span, 1);
+                               for (volatile int j = 0; j < 2000; ++j)
+                                   ;
+                               spanTest.hop(span, 2);
+                               for (volatile int j = 0; j < 5000; ++j)
+                                   ;
+                               spanTest.end(span);
+                               ++done;
+                           } });
+    for (int i = 0; i < 180; ++i)
+    {
+        SpanPerfTool::Span span = spanTest.begin();
+        for (volatile int j = 0; j < 500; ++j)
+            ;
+        spanTest.enqueue(span);
+        while (!requests.push(span))
+        {
+            std::this_thread::yield();
+        }
+    }
+    worker.join();
+    spanTest.report();
+
+    std::thread pipeline([]()
+                         {
+                             for (int i = 0; i < 180; ++i)
+                             {
+                                 handleRequest(i % 3);
+                             } });
+    for (int i = 0; i < 180; ++i)
+    {
+        handleRequest(1);
+    }
+    pipeline.join();
+    std::ofstream timerReport("timers.txt"), collapsed("timers.folded");
+    TimerRegistry::instance().report(timerReport);
+    TimerRegistry::instance().writeCollapsed(collapsed);
+    // the pipeline thread exited, its tree was folded into the retired aggregate
+    std::ostringstream timerText;
+    TimerRegistry::instance().report(timerText);
+    CHECK(timerText.str().find("\nrequest 360 ") != std::string::npos);
+    CHECK(timerText.str().find("\n  parse 360 ") != std::string::npos);
+
+    // per endpoint and shard, shard 7 is slow
+    LabeledPerfTool labeledTest;
+    static const uint32_t endpoints[] = {LabeledPerfTool::label("GET /user"), LabeledPerfTool::label("PUT /user"),
+                                         LabeledPerfTool::label("GET /order")};
+    std::vector<uint32_t> shards;
+    for (int shard = 0; shard < 16; ++shard)
+    {
+        shards.push_back(LabeledPerfTool::label("shard" + std::to_string(shard)));
+    }
+    for (int i = 0; i < 4800; ++i)
+    {
+        const int shard = i % 16;
+        const uint64_t begin = labeledTest.begin();
+        for (volatile int j = 0; j < (shard == 7 ? 5000 : 500); ++j)
+            ;
+        labeledTest.end(LabeledPerfTool::key(endpoints[i % 3], shards[shard]), begin);
+    }
+    std::ofstream labelReport("labels.txt");
+    labeledTest.report(labelReport);
+    labelReport << "top 5 by p99, " << labeledTest.size() << " keys in " << labeledTest.memoryBytes() << " bytes\n";
+    labeledTest.report(labelReport, 5);
+
+    ChromeTracer::instance().stop();
+
+    if (failedChecks != 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failedChecks);
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifndef THREAD_SHARDS_HEADER_GUARD
+#define THREAD_SHARDS_HEADER_GUARD
+
+#include "NanoLog.hpp"
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// hands the shards of a sharded perf tool out to the recording threads, one thread per shard
+// a thread claims a free shard the first time it records and gives it back when it exits, so
+// threads coming and going reuse the shards; once all of them are taken, further threads get
+// the shared shard (index shardCount()), written with fetch_add instead of single writer
+// stores, and the first such thread is logged
+class ShardPool
+{
+public:
+    // shards: shards a thread can own, the shared one comes on top
+    ShardPool(const std::string &describe, size_t shards)
+        : describe(describe), count(std::max<size_t>(shards, 1)), id(nextId())
+    {
+        for (size_t shard = count; shard > 0; --shard)
+        {
+            freeShards.push_back(uint32_t(shard - 1));
+        }
+    }
+
+    ShardPool(const ShardPool &) = delete;
+    ShardPool &operator=(const ShardPool &) = delete;
+
+    size_t shardCount(void) const { return count; }
+
+    // unique in the process, never reused like an address could be
+    uint64_t poolId(void) const { return id; }
+
+    // threads writing the shared shard now
+    uint64_t sharedThreads(void) const { return sharing.load(std::memory_order_relaxed); }
+
+    uint32_t claim(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeShards.empty())
+        {
+            const uint32_t shard = freeShards.back();
+            freeShards.pop_back();
+            return shard;
+        }
+        sharing.fetch_add(1, std::memory_order_relaxed);
+        if (!bOverflowLogged)
+        {
+            bOverflowLogged = true;
+            LOG_WARN << describe << " has more than " << count
+                     << " recording threads, the others share one shard with atomic increments";
+        }
+        return uint32_t(count);
+    }
+
+    // the mutex orders the last stores of the exiting thread before the first ones of the next owner
+    void release(uint32_t shard)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (shard == count)
+        {
+            sharing.fetch_sub(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            freeShards.push_back(shard);
+        }
+    }
+
+private:
+    const std::string describe;
+    const size_t count;
+    const uint64_t id;
+    std::mutex mutex;
+    std::vector<uint32_t> freeShards;
+    std::atomic<uint64_t> sharing{0};
+    bool bOverflowLogged = false;
+
+    static uint64_t nextId(void)
+    {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// a thread's claim on a pool
+// beginTime: the open interval of the thread, kept here so threads never share it
+struct ShardClaim
+{
+    uint32_t shard;
+    bool bShared;
+    uint64_t beginTime;
+};
+
+// the calling thread's claim on pool, made at the first call and returned to the pool when the
+// thread exits (dropped if the pool is gone by then)
+// hot path: a thread_local access and one compare while a thread records into one pool
+inline ShardClaim &localShardClaim(const std::shared_ptr<ShardPool> &pool)
+{
+    struct Claims
+    {
+        struct Entry
+        {
+            uint64_t poolId;
+            std::weak_ptr<ShardPool> pool;
+            ShardClaim claim;
+        };
+        std::vector<Entry> entries;
+        size_t last = 0;
+
+        ~Claims()
+        {
+            for (Entry &entry : entries)
+            {
+                if (std::shared_ptr<ShardPool> owner = entry.pool.lock())
+                {
+                    owner->release(entry.claim.shard);
+                }
+            }
+        }
+    };
+    static thread_local Claims claims;
+
+    const uint64_t poolId = pool->poolId();
+    if (claims.last < claims.entries.size() && claims.entries[claims.last].poolId == poolId)
+    {
+        return claims.entries[claims.last].claim;
+    }
+    for (size_t i = 0; i < claims.entries.size(); ++i)
+    {
+        if (claims.entries[i].poolId == poolId)
+        {
+            claims.last = i;
+            return claims.entries[i].claim;
+        }
+    }
+    // claims on destroyed pools would pile up in long lived threads
+    claims.entries.erase(std::remove_if(claims.entries.begin(), claims.entries.end(), [](const Claims::Entry &entry)
+                                        { return entry.pool.expired(); }),
+                         claims.entries.end());
+    const uint32_t shard = pool->claim();
+    claims.entries.push_back({poolId, pool, {shard, shard == pool->shardCount(), 0}});
+    claims.last = claims.entries.size() - 1;
+    return claims.entries.back().claim;
+}
+
+#endif /* THREAD_SHARDS_HEADER_GUARD */
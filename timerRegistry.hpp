@@ -0,0 +1,308 @@
+#ifndef TIMER_REGISTRY_HEADER_GUARD
+#define TIMER_REGISTRY_HEADER_GUARD
+
+#include "tscClock.hpp"
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+
+// process-wide tree of named timers
+// every thread keeps its own call tree: a timer started while another one is open on the
+// same thread becomes its child, so a parent's inclusive time splits into its children
+// and its self (exclusive) time
+// hot path: begin() / end() only touch the thread's own tree, no lock and no allocation;
+// the lock is only taken to register a timer name, the first time a thread times
+// anything, and by the reports
+// reports merge the trees of all threads by call path; the tree of an exiting thread is folded
+// into one retired aggregate and freed, so threads coming and going don't pile up trees
+class TimerRegistry
+{
+public:
+    // maxNodes: call paths per thread, intervals on paths beyond it are dropped and counted
+    // maxDepth: deepest nesting per thread
+    static constexpr int maxNodes = 4096, maxDepth = 256;
+
+    static TimerRegistry &instance(void)
+    {
+        static TimerRegistry registry;
+        return registry;
+    }
+
+    // id of the timer called name, registered on first use
+    // look it up once (e.g. into a static) and keep the id, this takes the lock
+    int timer(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (names[i] == name)
+            {
+                return int(i);
+            }
+        }
+        names.push_back(name);
+        return int(names.size() - 1);
+    }
+
+    // open timer id as a child of the innermost open timer of this thread
+    void begin(const int id)
+    {
+        ThreadTree &tree = localTree();
+        if (tree.depth == maxDepth)
+        {
+            ++tree.overflowDepth;
+            return;
+        }
+        const int parent = tree.depth == 0 ? 0 : tree.frames[tree.depth - 1].node;
+        Frame &frame = tree.frames[tree.depth++];
+        frame.node = parent < 0 ? -1 : tree.child(parent, id);
+        frame.childTicks = 0;
+        frame.beginTime = TscClock::beginTicks();
+    }
+
+    // close the innermost open timer of this thread
+    void end(void)
+    {
+        const uint64_t endTime = TscClock::endTicks();
+        ThreadTree &tree = localTree();
+        if (tree.overflowDepth != 0)
+        {
+            --tree.overflowDepth;
+            return;
+        }
+        if (tree.depth == 0)
+        {
+            return;
+        }
+        const Frame &frame = tree.frames[--tree.depth];
+        const uint64_t inclusive = endTime - frame.beginTime;
+        if (frame.node >= 0)
+        {
+            Node &node = tree.nodes[frame.node];
+            increase(node.count, 1);
+            increase(node.inclusive, inclusive);
+            increase(node.self, inclusive - std::min(inclusive, frame.childTicks));
+        }
+        if (tree.depth != 0)
+        {
+            tree.frames[tree.depth - 1].childTicks += inclusive;
+        }
+    }
+
+    // indented tree: count, inclusive and self time in ns of every call path
+    void report(std::ostream &os)
+    {
+        Merged root;
+        std::vector<std::string> timerNames = merge(root);
+        os << "timer count inclusive(ns) self(ns) mean(ns)\n";
+        reportNode(os, root, timerNames, 0);
+        uint64_t dropped = droppedTotal();
+        if (dropped != 0)
+        {
+            os << "dropped " << dropped << " intervals, more than " << maxNodes << " call paths on a thread\n";
+        }
+    }
+
+    // one line per call path, "outer;inner;innermost <self ns>", the input of flamegraph.pl
+    void writeCollapsed(std::ostream &os)
+    {
+        Merged root;
+        std::vector<std::string> timerNames = merge(root);
+        std::string path;
+        collapsedNode(os, root, timerNames, path);
+    }
+
+private:
+    // one call path of one thread, written by the owning thread only
+    struct Node
+    {
+        int timer;
+        // children form a list, published with release so reports can walk it meanwhile
+        std::atomic<int> firstChild{-1}, nextSibling{-1};
+        // in ticks
+        std::atomic<uint64_t> count{0}, inclusive{0}, self{0};
+    };
+
+    struct Frame
+    {
+        int node;
+        uint64_t beginTime, childTicks;
+    };
+
+    struct ThreadTree
+    {
+        std::unique_ptr<Node[]> nodes{new Node[maxNodes]};
+        std::atomic<int> nodeCount{1};
+        Frame frames[maxDepth];
+        int depth = 0, overflowDepth = 0;
+        std::atomic<uint64_t> dropped{0};
+
+        // the child of parent for timer id, created on first use; -1 if the tree is full
+        int child(const int parent, const int id)
+        {
+            for (int i = nodes[parent].firstChild.load(std::memory_order_relaxed); i >= 0;
+                 i = nodes[i].nextSibling.load(std::memory_order_relaxed))
+            {
+                if (nodes[i].timer == id)
+                {
+                    return i;
+                }
+            }
+            const int index = nodeCount.load(std::memory_order_relaxed);
+            if (index == maxNodes)
+            {
+                increase(dropped, 1);
+                return -1;
+            }
+            nodes[index].timer = id;
+            nodes[index].nextSibling.store(nodes[parent].firstChild.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            nodeCount.store(index + 1, std::memory_order_relaxed);
+            nodes[parent].firstChild.store(index, std::memory_order_release);
+            return index;
+        }
+    };
+
+    // call paths of all threads merged, children by timer id
+    struct Merged
+    {
+        uint64_t count = 0, inclusive = 0, self = 0;
+        std::map<int, Merged> children;
+    };
+
+    std::mutex mutex;
+    std::vector<std::string> names;
+    // trees of the running threads
+    std::vector<std::unique_ptr<ThreadTree>> trees;
+    // call paths and drops of the threads that exited
+    Merged retired;
+    uint64_t retiredDropped = 0;
+
+    // hands the tree of its thread back to the registry when the thread exits
+    struct TreeOwner
+    {
+        TimerRegistry *registry = nullptr;
+        ThreadTree *tree = nullptr;
+
+        ~TreeOwner()
+        {
+            if (tree != nullptr)
+            {
+                registry->retire(tree);
+            }
+        }
+    };
+
+    TimerRegistry() = default;
+
+    // single writer, a plain load and store is enough
+    static void increase(std::atomic<uint64_t> &counter, const uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    ThreadTree &localTree(void)
+    {
+        // a plain pointer on the hot path, the owner with a destructor is only touched once
+        static thread_local ThreadTree *tree = nullptr;
+        if (tree == nullptr)
+        {
+            static thread_local TreeOwner owner;
+            std::lock_guard<std::mutex> lock(mutex);
+            trees.emplace_back(new ThreadTree());
+            tree = trees.back().get();
+            tree->nodes[0].timer = -1;
+            owner.registry = this;
+            owner.tree = tree;
+        }
+        return *tree;
+    }
+
+    void retire(ThreadTree *tree)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        mergeNode(*tree, 0, retired);
+        retiredDropped += tree->dropped.load(std::memory_order_relaxed);
+        trees.erase(std::find_if(trees.begin(), trees.end(), [tree](const std::unique_ptr<ThreadTree> &owned)
+                                 { return owned.get() == tree; }));
+    }
+
+    uint64_t droppedTotal(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t dropped = retiredDropped;
+        for (const std::unique_ptr<ThreadTree> &tree : trees)
+        {
+            dropped += tree->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+
+    // return a copy of the names, the lock is not held while writing the report
+    std::vector<std::string> merge(Merged &root)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        root = retired;
+        for (const std::unique_ptr<ThreadTree> &tree : trees)
+        {
+            mergeNode(*tree, 0, root);
+        }
+        return names;
+    }
+
+    static void mergeNode(const ThreadTree &tree, const int index, Merged &merged)
+    {
+        for (int i = tree.nodes[index].firstChild.load(std::memory_order_acquire); i >= 0;
+             i = tree.nodes[i].nextSibling.load(std::memory_order_acquire))
+        {
+            const Node &node = tree.nodes[i];
+            Merged &child = merged.children[node.timer];
+            child.count += node.count.load(std::memory_order_relaxed);
+            child.inclusive += node.inclusive.load(std::memory_order_relaxed);
+            child.self += node.self.load(std::memory_order_relaxed);
+            mergeNode(tree, i, child);
+        }
+    }
+
+    static void reportNode(std::ostream &os, const Merged &merged, const std::vector<std::string> &timerNames, const int depth)
+    {
+        for (const auto &[timer, child] : merged.children)
+        {
+            const double inclusive = TscClock::ticksToNs(child.inclusive);
+            os << std::string(depth * 2, ' ') << timerNames[timer] << ' ' << child.count << ' '
+               << uint64_t(inclusive) << ' ' << uint64_t(TscClock::ticksToNs(child.self)) << ' '
+               << (child.count == 0 ? 0 : uint64_t(inclusive / child.count)) << '\n';
+            reportNode(os, child, timerNames, depth + 1);
+        }
+    }
+
+    static void collapsedNode(std::ostream &os, const Merged &merged, const std::vector<std::string> &timerNames, std::string &path)
+    {
+        for (const auto &[timer, child] : merged.children)
+        {
+            const size_t length = path.size();
+            path += (length == 0 ? "" : ";") + timerNames[timer];
+            os << path << ' ' << uint64_t(TscClock::ticksToNs(child.self)) << '\n';
+            collapsedNode(os, child, timerNames, path);
+            path.resize(length);
+        }
+    }
+};
+
+// RAII timer of the registry
+// static const int id = TimerRegistry::instance().timer("parse"); TimerScope scope(id);
+class TimerScope
+{
+public:
+    explicit TimerScope(const int id) { TimerRegistry::instance().begin(id); }
+    ~TimerScope() { TimerRegistry::instance().end(); }
+    TimerScope(const TimerScope &) = delete;
+    TimerScope &operator=(const TimerScope &) = delete;
+};
+
+#endif /* TIMER_REGISTRY_HEADER_GUARD */
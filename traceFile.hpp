@@ -0,0 +1,220 @@
+#ifndef TRACE_FILE_HEADER_GUARD
+#define TRACE_FILE_HEADER_GUARD
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// binary trace of every single sample, one fixed-size record per measured interval
+// layout: TraceHeader, then capacity TraceRecords used as a ring
+// the file is preallocated and mapped once, recording is a few stores into the mapping:
+// no syscall, no allocation and no formatting on the measured thread
+
+// ticks are raw clock ticks, realtimeNs = realtimeNsBase + (tick - tickBase) * nsPerTick
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    // clock calibration
+    double nsPerTick;
+    uint64_t tickBase, realtimeNsBase;
+    // instance metadata
+    uint64_t capacity;
+    // records written so far, the ring holds the last min(writeIndex, capacity) of them
+    uint64_t writeIndex;
+    int32_t pid;
+    uint32_t reserved;
+    char name[64];
+};
+
+struct TraceRecord
+{
+    uint64_t startTick;
+    uint64_t durationTicks;
+    uint32_t threadId;
+    uint32_t reserved;
+    uint64_t tag;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "trace records are 32 bytes");
+
+static const char TRACE_MAGIC[8] = {'P', 'E', 'R', 'F', 'T', 'R', 'C', '\0'};
+static const uint32_t TRACE_VERSION = 1;
+
+// single writer, owned by the thread that measures
+class TraceWriter
+{
+public:
+    // path: the file is created or truncated
+    // name: stored in the header, usually the describe of the perf tool
+    // capacity: records in the ring, the file is sizeof(TraceHeader) + 32 * capacity bytes
+    // nsPerTick, tickBase, realtimeNsBase: calibration of the ticks that will be recorded
+    TraceWriter(const std::string &path, const std::string &name, uint64_t capacity,
+                double nsPerTick, uint64_t tickBase, uint64_t realtimeNsBase)
+        : capacity(std::max<uint64_t>(capacity, 1))
+    {
+        mappedBytes = sizeof(TraceHeader) + this->capacity * sizeof(TraceRecord);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return;
+        }
+        // allocate the blocks now, a sparse file would fault on the measured thread
+        if (posix_fallocate(fd, 0, mappedBytes) != 0 && ftruncate(fd, mappedBytes) != 0)
+        {
+            close(fd);
+            return;
+        }
+        void *mapping = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return;
+        }
+        header = static_cast<TraceHeader *>(mapping);
+        records = reinterpret_cast<TraceRecord *>(header + 1);
+
+        memset(header, 0, sizeof(TraceHeader));
+        memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header->version = TRACE_VERSION;
+        header->recordSize = sizeof(TraceRecord);
+        header->nsPerTick = nsPerTick;
+        header->tickBase = tickBase;
+        header->realtimeNsBase = realtimeNsBase;
+        header->capacity = this->capacity;
+        header->pid = getpid();
+        strncpy(header->name, name.c_str(), sizeof(header->name) - 1);
+    }
+
+    ~TraceWriter()
+    {
+        if (header != nullptr)
+        {
+            munmap(header, mappedBytes);
+        }
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    // false if the file couldn't be created or mapped, record() is a no-op then
+    bool isOpen(void) const { return header != nullptr; }
+
+    void record(uint64_t startTick, uint64_t durationTicks, uint64_t tag)
+    {
+        if (header == nullptr)
+        {
+            return;
+        }
+        TraceRecord &record = records[next];
+        record.startTick = startTick;
+        record.durationTicks = durationTicks;
+        record.threadId = threadId();
+        record.tag = tag;
+        next = next + 1 == capacity ? 0 : next + 1;
+        header->writeIndex = ++written;
+    }
+
+    uint64_t size(void) const { return written; }
+
+    // gettid() once per thread, not once per record
+    static uint32_t threadId(void)
+    {
+        static thread_local uint32_t tid = uint32_t(syscall(SYS_gettid));
+        return tid;
+    }
+
+private:
+    const uint64_t capacity;
+    size_t mappedBytes;
+    TraceHeader *header = nullptr;
+    TraceRecord *records = nullptr;
+    uint64_t next = 0, written = 0;
+};
+
+// read-only view of a trace file, records come out oldest first
+class TraceReader
+{
+public:
+    explicit TraceReader(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        off_t fileBytes = lseek(fd, 0, SEEK_END);
+        if (fileBytes < off_t(sizeof(TraceHeader)))
+        {
+            close(fd);
+            return;
+        }
+        void *mapping = mmap(nullptr, fileBytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return;
+        }
+        mappedBytes = fileBytes;
+        header = static_cast<const TraceHeader *>(mapping);
+        records = reinterpret_cast<const TraceRecord *>(header + 1);
+        if (memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header->version != TRACE_VERSION ||
+            header->recordSize != sizeof(TraceRecord) ||
+            header->capacity > (mappedBytes - sizeof(TraceHeader)) / sizeof(TraceRecord))
+        {
+            munmap(const_cast<TraceHeader *>(header), mappedBytes);
+            header = nullptr;
+            return;
+        }
+        // sequential scan, let the kernel read ahead
+        madvise(const_cast<TraceHeader *>(header), mappedBytes, MADV_SEQUENTIAL);
+    }
+
+    ~TraceReader()
+    {
+        if (header != nullptr)
+        {
+            munmap(const_cast<TraceHeader *>(header), mappedBytes);
+        }
+    }
+
+    TraceReader(const TraceReader &) = delete;
+    TraceReader &operator=(const TraceReader &) = delete;
+
+    // false if the file is missing, truncated or not a trace file
+    bool isOpen(void) const { return header != nullptr; }
+
+    const TraceHeader &info(void) const { return *header; }
+
+    // records still in the ring
+    uint64_t size(void) const { return std::min(header->writeIndex, header->capacity); }
+
+    // i: 0 is the oldest record still in the ring
+    const TraceRecord &at(uint64_t i) const
+    {
+        uint64_t first = header->writeIndex > header->capacity ? header->writeIndex % header->capacity : 0;
+        uint64_t slot = first + i;
+        return records[slot >= header->capacity ? slot - header->capacity : slot];
+    }
+
+    double toNs(uint64_t ticks) const { return ticks * header->nsPerTick; }
+
+    // absolute CLOCK_REALTIME ns of a start tick
+    int64_t toRealtimeNs(uint64_t tick) const
+    {
+        return int64_t(header->realtimeNsBase) + int64_t((int64_t(tick - header->tickBase)) * header->nsPerTick);
+    }
+
+private:
+    size_t mappedBytes = 0;
+    const TraceHeader *header = nullptr;
+    const TraceRecord *records = nullptr;
+};
+
+#endif /* TRACE_FILE_HEADER_GUARD */
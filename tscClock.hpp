@@ -0,0 +1,228 @@
+#ifndef TSC_CLOCK_HEADER_GUARD
+#define TSC_CLOCK_HEADER_GUARD
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <time.h>
+#include <cpuid.h>
+#include <x86intrin.h>
+
+// TSC clock source
+// the TSC is only trusted when cpuid reports an invariant TSC (constant rate,
+// keeps counting in deep C-states) and calibration succeeded, otherwise every
+// read falls back to clock_gettime(CLOCK_MONOTONIC_RAW) and ticks are ns
+class TscClock
+{
+public:
+    // read a timestamp at the beginning of a measured interval
+    // the first lfence stops rdtsc from running ahead of earlier instructions,
+    // the second one stops the measured code from starting before rdtsc
+    static inline uint64_t beginTicks(void)
+    {
+        if (!instance().useTsc.load(std::memory_order_relaxed))
+        {
+            return monotonicRawNs();
+        }
+        _mm_lfence();
+        uint64_t ticks = __rdtsc();
+        _mm_lfence();
+        return ticks;
+    }
+
+    // read a timestamp at the end of a measured interval
+    // rdtscp waits until the measured code has executed, lfence stops
+    // the following instructions from starting before the read
+    static inline uint64_t endTicks(void)
+    {
+        if (!instance().useTsc.load(std::memory_order_relaxed))
+        {
+            return monotonicRawNs();
+        }
+        unsigned int aux;
+        uint64_t ticks = __rdtscp(&aux);
+        _mm_lfence();
+        return ticks;
+    }
+
+    // convert a tick delta to ns
+    // only the rate is read, one atomic load is consistent on its own
+    static inline double ticksToNs(uint64_t ticks)
+    {
+        return ticks * instance().nsPerTick.load(std::memory_order_relaxed);
+    }
+
+    // convert an absolute tick value to ns on the CLOCK_MONOTONIC_RAW time line
+    static inline uint64_t ticksToMonotonicNs(uint64_t ticks)
+    {
+        const Snapshot snapshot = instance().load();
+        if (!snapshot.useTsc)
+        {
+            return ticks;
+        }
+        int64_t delta = int64_t(ticks - snapshot.tscBase);
+        return snapshot.nsBase + int64_t(delta * snapshot.nsPerTick);
+    }
+
+    static inline double ticksPerNs(void)
+    {
+        return 1.0 / instance().nsPerTick.load(std::memory_order_relaxed);
+    }
+
+    // true if timestamps come from the TSC, false if they come from clock_gettime
+    static inline bool reliable(void)
+    {
+        return instance().useTsc.load(std::memory_order_relaxed);
+    }
+
+    // cpuid leaf 0x80000007, edx bit 8: invariant TSC
+    static bool invariant(void)
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+        {
+            return false;
+        }
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        if ((edx & (1u << 8)) == 0)
+        {
+            return false;
+        }
+        // rdtscp is used at the end of every interval
+        __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        return (edx & (1u << 27)) != 0;
+    }
+
+    // measure ticks per ns against CLOCK_MONOTONIC_RAW
+    // durationMs: how long to spin between the two reference points, longer is more precise
+    // return false (and switch to the clock_gettime fallback) if the TSC can't be used
+    static bool calibrate(int durationMs = 20)
+    {
+        return calibrate(instance(), durationMs);
+    }
+
+    static inline uint64_t monotonicRawNs(void)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+private:
+    struct Snapshot
+    {
+        bool useTsc;
+        double nsPerTick;
+        uint64_t tscBase, nsBase;
+    };
+
+    // the values are published together under a seqlock, so a reader converting during a
+    // recalibration never mixes the base of one calibration with the rate of another
+    // useTsc and nsPerTick can also be read on their own by the hot paths
+    struct Calibration
+    {
+        std::atomic<bool> useTsc{false};
+        std::atomic<double> nsPerTick{1.0};
+        std::atomic<uint64_t> tscBase{0}, nsBase{0};
+        // odd while a store is in progress
+        std::atomic<uint32_t> sequence{0};
+        // one store at a time
+        std::mutex storeMutex;
+
+        Calibration()
+        {
+            calibrate(*this, 20);
+        }
+
+        Snapshot load(void) const
+        {
+            for (;;)
+            {
+                const uint32_t before = sequence.load(std::memory_order_acquire);
+                if ((before & 1) == 0)
+                {
+                    const Snapshot snapshot{useTsc.load(std::memory_order_relaxed), nsPerTick.load(std::memory_order_relaxed),
+                                            tscBase.load(std::memory_order_relaxed), nsBase.load(std::memory_order_relaxed)};
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (sequence.load(std::memory_order_relaxed) == before)
+                    {
+                        return snapshot;
+                    }
+                }
+            }
+        }
+
+        void store(const Snapshot &snapshot)
+        {
+            std::lock_guard<std::mutex> lock(storeMutex);
+            const uint32_t before = sequence.load(std::memory_order_relaxed);
+            sequence.store(before + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            tscBase.store(snapshot.tscBase, std::memory_order_relaxed);
+            nsBase.store(snapshot.nsBase, std::memory_order_relaxed);
+            nsPerTick.store(snapshot.nsPerTick, std::memory_order_relaxed);
+            useTsc.store(snapshot.useTsc, std::memory_order_relaxed);
+            sequence.store(before + 2, std::memory_order_release);
+        }
+    };
+
+    // calibrated once at first use, calibrate() can be called again at any time
+    static Calibration &instance(void)
+    {
+        static Calibration calib;
+        return calib;
+    }
+
+    static bool calibrate(Calibration &calib, int durationMs)
+    {
+        if (!invariant())
+        {
+            calib.store({false, 1.0, 0, 0});
+            return false;
+        }
+
+        uint64_t tsc0 = 0, ns0 = 0, tsc1 = 0, ns1 = 0;
+        referencePoint(tsc0, ns0);
+        while (monotonicRawNs() - ns0 < uint64_t(durationMs) * 1000000)
+            ;
+        referencePoint(tsc1, ns1);
+
+        // a TSC running backwards or a nonsense frequency means it can't be trusted
+        if (tsc1 <= tsc0 || ns1 <= ns0)
+        {
+            calib.store({false, 1.0, 0, 0});
+            return false;
+        }
+        double nsPerTick = double(ns1 - ns0) / double(tsc1 - tsc0);
+        if (nsPerTick < 0.01 || nsPerTick > 10)
+        {
+            calib.store({false, 1.0, 0, 0});
+            return false;
+        }
+
+        calib.store({true, nsPerTick, tsc1, ns1});
+        return true;
+    }
+
+    // pair a TSC read with a CLOCK_MONOTONIC_RAW read
+    // keep the tightest of a few attempts so a preemption doesn't skew the pair
+    static void referencePoint(uint64_t &tsc, uint64_t &ns)
+    {
+        uint64_t bestWindow = UINT64_MAX;
+        for (int i = 0; i < 16; ++i)
+        {
+            unsigned int aux;
+            uint64_t before = __rdtscp(&aux);
+            uint64_t now = monotonicRawNs();
+            uint64_t after = __rdtscp(&aux);
+            if (after - before < bestWindow)
+            {
+                bestWindow = after - before;
+                tsc = before + (after - before) / 2;
+                ns = now;
+            }
+        }
+    }
+};
+
+#endif /* TSC_CLOCK_HEADER_GUARD */